@@ -0,0 +1,47 @@
+#include <cmath>
+#include <random>
+#include <algorithm>
+
+#include "FunctionApproximation.h"
+
+using namespace std;
+
+void Function_Approximation::valuesOutside(const vector<double*> &coordinates, const vector<unsigned int> &outside, double * values)
+{
+    if (outside.empty() || !exact) return;
+    unsigned int ndim = coordinates.size();
+    vector<vector<double> > buffer(ndim, vector<double>(outside.size()));
+    vector<double*> out_coordinates(ndim);
+    for (unsigned int i=0; i<ndim; i++) {
+        for (unsigned int k=0; k<outside.size(); k++) buffer[i][k] = coordinates[i][outside[k]];
+        out_coordinates[i] = &buffer[i][0];
+    }
+    vector<double> out_values(outside.size());
+    exact->valuesAt(out_coordinates, outside.size(), &out_values[0]);
+    for (unsigned int k=0; k<outside.size(); k++) values[outside[k]] = out_values[k];
+}
+
+double Function_Approximation::sampledError(const vector<double> &xmin, const vector<double> &xmax, unsigned int nsamples, double scale)
+{
+    if (nsamples == 0 || !exact) return 0.;
+    unsigned int ndim = xmin.size();
+    // fixed seed so that the check is reproducible
+    mt19937 rng(12345);
+    vector<vector<double> > buffer(ndim, vector<double>(nsamples));
+    vector<double*> coordinates(ndim);
+    for (unsigned int i=0; i<ndim; i++) {
+        uniform_real_distribution<double> dist(xmin[i], xmax[i]);
+        for (unsigned int p=0; p<nsamples; p++) buffer[i][p] = dist(rng);
+        coordinates[i] = &buffer[i][0];
+    }
+    vector<double> exact_values(nsamples), values(nsamples);
+    exact->valuesAt(coordinates, nsamples, &exact_values[0]);
+    valuesAt(coordinates, nsamples, &values[0]);
+    double error = 0.;
+    for (unsigned int p=0; p<nsamples; p++) {
+        error = max(error, abs(values[p] - exact_values[p]));
+        scale = max(scale, abs(exact_values[p]));
+    }
+    measured_error = scale > 0. ? error / scale : error;
+    return measured_error;
+}
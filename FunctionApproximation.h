@@ -0,0 +1,48 @@
+#ifndef FunctionApproximation_H
+#define FunctionApproximation_H
+
+#include <vector>
+#include <memory>
+#include "Profile.h"
+
+//  -------------------------------------------------------------------------------------------
+//! Function replaced by a cheaper approximation (Function_Tabulated, Function_Chebyshev) on a domain:
+//! the points outside of it are passed to the exact function, and the error is measured against it.
+//  -------------------------------------------------------------------------------------------
+class Function_Approximation : public Function
+{
+public:
+    //! exact is NULL when there is no exact function (points outside of the domain then give 0)
+    Function_Approximation(Function *ex) : exact(ex), measured_error(0.) {};
+    
+    //! points outside of the domain use the exact function
+    bool usesPython() {
+        return exact && exact->usesPython();
+    };
+    
+    //! Result of the last maxError
+    inline double getMeasuredError() {
+        return measured_error;
+    };
+    
+    //! The exact function is kept alive by the approximation (it may be shared, see ProfileRegistry)
+    inline void shareExact(std::shared_ptr<Function> owner) {
+        exact_owner = owner;
+    };
+    
+protected:
+    //! Values of the exact function at the points outside[0], outside[1], ... of coordinates,
+    //! gathered and evaluated at once (values at the other points unchanged)
+    void valuesOutside(const std::vector<double*> &coordinates, const std::vector<unsigned int> &outside, double * values);
+    
+    //! Largest difference between valuesAt and the exact function on nsamples random points of the box
+    //! [xmin[0], xmax[0]] x [xmin[1], xmax[1]] x ..., relative to the largest exact value or scale
+    double sampledError(const std::vector<double> &xmin, const std::vector<double> &xmax, unsigned int nsamples, double scale);
+    
+    //! Function approximated
+    Function *exact;
+    std::shared_ptr<Function> exact_owner;
+    double measured_error;
+};
+
+#endif
@@ -0,0 +1,270 @@
+#include <cmath>
+#include <sstream>
+#include <algorithm>
+
+#include "FunctionChebyshev.h"
+
+using namespace std;
+
+// Number of points evaluated together by valuesAt
+static const unsigned int block = 32;
+
+Function_Chebyshev::Function_Chebyshev(Function *ex, vector<double> x0, vector<double> x1, vector<unsigned int> n) :
+    Function_Approximation(ex),
+    xmin(x0),
+    xmax(x1),
+    ncoefficients(n),
+    npolynomials(0),
+    scale(0.)
+{
+    unsigned int ndim = ncoefficients.size();
+    if (ndim < 1 || ndim > 3 || xmin.size() != ndim || xmax.size() != ndim) {
+        ERROR("Chebyshev profile: " << ndim << " variables not supported (1 to 3, with a box along each)");
+    }
+    // Chebyshev points of the first kind along each variable
+    vector<vector<double> > axes(ndim);
+    center.resize(ndim);
+    inv_half.resize(ndim);
+    size_t size = 1;
+    for (unsigned int i=0; i<ndim; i++) {
+        ncoefficients[i] = min(max(ncoefficients[i], 1u), (unsigned int) max_ncoefficients);
+        center[i] = 0.5*(xmin[i]+xmax[i]);
+        double half = 0.5*(xmax[i]-xmin[i]);
+        inv_half[i] = 1./half;
+        axes[i].resize(ncoefficients[i]);
+        for (unsigned int k=0; k<ncoefficients[i]; k++) axes[i][k] = center[i] + half * cos(M_PI*(k+0.5)/ncoefficients[i]);
+        size *= ncoefficients[i];
+    }
+    coefficients.resize(size);
+    exact->valuesAtGrid(axes, &coefficients[0], layout_rowMajor, 65536);
+    for (size_t k=0; k<size; k++) scale = max(scale, abs(coefficients[k]));
+
+    // Cosine transform of the values along each variable, in place
+    size_t outer = 1;
+    for (unsigned int i=0; i<ndim; i++) {
+        unsigned int m = ncoefficients[i];
+        size_t inner = size / (outer*m);
+        vector<double> cosines(m*m), line(m);
+        for (unsigned int j=0; j<m; j++) {
+            for (unsigned int k=0; k<m; k++) cosines[j*m+k] = cos(M_PI*j*(k+0.5)/m);
+        }
+        for (size_t o=0; o<outer; o++) {
+            for (size_t r=0; r<inner; r++) {
+                double * a = &coefficients[o*m*inner + r];
+                for (unsigned int k=0; k<m; k++) line[k] = a[k*inner];
+                for (unsigned int j=0; j<m; j++) {
+                    double s = 0.;
+                    for (unsigned int k=0; k<m; k++) s += cosines[j*m+k] * line[k];
+                    a[j*inner] = (j==0 ? 1. : 2.) * s / m;
+                }
+            }
+        }
+        outer *= m;
+    }
+    keep(0.);
+}
+
+Function_Chebyshev::~Function_Chebyshev()
+{
+}
+
+bool Function_Chebyshev::inside(const double * x)
+{
+    for (unsigned int i=0; i<xmin.size(); i++) {
+        if (!(x[i] >= xmin[i] && x[i] <= xmax[i])) return false;
+    }
+    return true;
+}
+
+vector<bool> Function_Chebyshev::resolved(double tolerance)
+{
+    unsigned int ndim = ncoefficients.size();
+    vector<bool> result(ndim, true);
+    if (coefficients.empty()) return result;
+    // the coefficients do not decrease below the rounding errors of the samples
+    double threshold = max(0.1*tolerance, 1e-14) * scale;
+    size_t outer = 1;
+    for (unsigned int i=0; i<ndim; i++) {
+        unsigned int m = ncoefficients[i];
+        size_t inner = coefficients.size() / (outer*m);
+        double last = 0.;
+        for (size_t o=0; o<outer; o++) {
+            for (size_t r=0; r<inner; r++) {
+                for (unsigned int j=max(m, 2u)-2; j<m; j++) last = max(last, abs(coefficients[(o*m+j)*inner + r]));
+            }
+        }
+        result[i] = m >= 4 && last <= threshold;
+        outer *= m;
+    }
+    return result;
+}
+
+void Function_Chebyshev::truncate(double tolerance)
+{
+    // the dropped coefficients add up to less than tolerance/2 (|T_j| <= 1)
+    keep(0.5 * tolerance * scale);
+    vector<double>().swap(coefficients);
+}
+
+void Function_Chebyshev::keep(double threshold)
+{
+    unsigned int ndim = ncoefficients.size();
+    size_t size = coefficients.size();
+    vector<size_t> order(size);
+    for (size_t k=0; k<size; k++) order[k] = k;
+    sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+        double ca = abs(coefficients[a]), cb = abs(coefficients[b]);
+        return ca < cb || (ca == cb && a < b);
+    });
+    double dropped = 0.;
+    size_t ndropped = 0;
+    while (ndropped < size && dropped + abs(coefficients[order[ndropped]]) <= threshold) {
+        dropped += abs(coefficients[order[ndropped++]]);
+    }
+    vector<bool> kept(size, false);
+    for (size_t k=ndropped; k<size; k++) kept[order[k]] = true;
+
+    // rows up to their last kept coefficient (the dropped ones before it are kept as well, at no cost)
+    unsigned int m = ncoefficients[ndim-1];
+    ndegrees.assign(ndim, 1);
+    terms.clear();
+    row_start.assign(1, 0);
+    vector<unsigned int> degrees;
+    for (size_t r=0; r<size/m; r++) {
+        unsigned int length = m;
+        while (length > 0 && !kept[r*m+length-1]) length--;
+        if (length == 0) continue;
+        terms.insert(terms.end(), coefficients.begin() + r*m, coefficients.begin() + r*m + length);
+        row_start.push_back(terms.size());
+        ndegrees[ndim-1] = max(ndegrees[ndim-1], length);
+        size_t q = r;
+        for (int i=ndim-2; i>=0; i--) {
+            degrees.push_back(q % ncoefficients[i]);
+            q /= ncoefficients[i];
+            ndegrees[i] = max(ndegrees[i], degrees.back()+1);
+        }
+    }
+    first.resize(ndim);
+    npolynomials = 0;
+    for (unsigned int i=0; i<ndim; i++) {
+        first[i] = npolynomials;
+        npolynomials += ndegrees[i];
+    }
+    // (the degrees of each row were pushed from the last variable but one to the first)
+    row_polynomials.resize(degrees.size());
+    for (size_t r=0; r+1<row_start.size(); r++) {
+        for (unsigned int i=0; i+1<ndim; i++) {
+            row_polynomials[r*(ndim-1)+i] = first[i] + degrees[r*(ndim-1) + ndim-2-i];
+        }
+    }
+}
+
+void Function_Chebyshev::sums(const double * t, unsigned int stride, unsigned int npoints, double * values, double * polynomials)
+{
+    unsigned int ndim = ndegrees.size();
+    // T_j(t) along each variable by the recurrence T_j = 2 t T_j-1 - T_j-2
+    for (unsigned int i=0; i<ndim; i++) {
+        double * T = polynomials + first[i]*npoints;
+        const double * ti = t + i*stride;
+        for (unsigned int p=0; p<npoints; p++) T[p] = 1.;
+        if (ndegrees[i] > 1) {
+            for (unsigned int p=0; p<npoints; p++) T[npoints+p] = ti[p];
+        }
+        for (unsigned int j=2; j<ndegrees[i]; j++) {
+            double * Tj = T + j*npoints;
+            const double * Tj1 = Tj - npoints, * Tj2 = Tj1 - npoints;
+            for (unsigned int p=0; p<npoints; p++) Tj[p] = 2.*ti[p]*Tj1[p] - Tj2[p];
+        }
+    }
+    const double * last = polynomials + first[ndim-1]*npoints;
+    double row[block];
+    for (unsigned int p=0; p<npoints; p++) values[p] = 0.;
+    for (size_t r=0; r+1<row_start.size(); r++) {
+        // dot product along the last variable, then the polynomials of the row along the first ones
+        for (unsigned int p=0; p<npoints; p++) row[p] = 0.;
+        for (size_t k=row_start[r], j=0; k<row_start[r+1]; k++, j++) {
+            const double c = terms[k], * Tj = last + j*npoints;
+            for (unsigned int p=0; p<npoints; p++) row[p] += c * Tj[p];
+        }
+        for (unsigned int i=0; i+1<ndim; i++) {
+            const double * Ti = polynomials + row_polynomials[r*(ndim-1)+i]*npoints;
+            for (unsigned int p=0; p<npoints; p++) row[p] *= Ti[p];
+        }
+        for (unsigned int p=0; p<npoints; p++) values[p] += row[p];
+    }
+}
+
+double Function_Chebyshev::valueAt(const double * x)
+{
+    if (!inside(x)) return exact ? exact->valueAt(x) : 0.;
+    unsigned int ndim = ndegrees.size();
+    double T[3*max_ncoefficients];
+    for (unsigned int i=0; i<ndim; i++) {
+        double t = (x[i]-center[i]) * inv_half[i], * Ti = T + first[i];
+        Ti[0] = 1.;
+        if (ndegrees[i] > 1) Ti[1] = t;
+        for (unsigned int j=2; j<ndegrees[i]; j++) Ti[j] = 2.*t*Ti[j-1] - Ti[j-2];
+    }
+    const double * last = T + first[ndim-1], * c = terms.data();
+    const unsigned int * q = row_polynomials.data();
+    double value = 0.;
+    const size_t * start = row_start.data();
+    for (size_t r=0; r+1<row_start.size(); r++) {
+        // independent partial sums, as each addition waits for the previous one
+        const double * cr = c + start[r];
+        size_t length = start[r+1] - start[r], j = 0;
+        double s0 = 0., s1 = 0., s2 = 0., s3 = 0.;
+        for (; j+4<=length; j+=4) {
+            s0 += cr[j] * last[j];
+            s1 += cr[j+1] * last[j+1];
+            s2 += cr[j+2] * last[j+2];
+            s3 += cr[j+3] * last[j+3];
+        }
+        for (; j<length; j++) s0 += cr[j] * last[j];
+        double row = (s0 + s1) + (s2 + s3);
+        for (unsigned int i=0; i+1<ndim; i++) row *= T[*q++];
+        value += row;
+    }
+    return value;
+}
+
+void Function_Chebyshev::valuesAt(const vector<double*> &coordinates, unsigned int npoints, double * values)
+{
+    unsigned int ndim = ncoefficients.size();
+    double x[3], t[3*block], v[block];
+    unsigned int index[block], n = 0;
+    vector<double> polynomials(npolynomials*block);
+    // points inside the box are summed by blocks, those outside are gathered and evaluated at once by the exact function
+    vector<unsigned int> outside;
+    for (unsigned int p=0; p<npoints; p++) {
+        for (unsigned int i=0; i<ndim; i++) x[i] = coordinates[i][p];
+        if (inside(x)) {
+            for (unsigned int i=0; i<ndim; i++) t[i*block+n] = (x[i]-center[i]) * inv_half[i];
+            index[n++] = p;
+        } else {
+            values[p] = 0.;
+            outside.push_back(p);
+        }
+        if (n == block || (p+1 == npoints && n > 0)) {
+            sums(t, block, n, v, polynomials.data());
+            for (unsigned int k=0; k<n; k++) values[index[k]] = v[k];
+            n = 0;
+        }
+    }
+    valuesOutside(coordinates, outside, values);
+}
+
+double Function_Chebyshev::maxError(unsigned int nsamples)
+{
+    return sampledError(xmin, xmax, nsamples, scale);
+}
+
+string Function_Chebyshev::getInfo()
+{
+    ostringstream info;
+    info << "Chebyshev expansion of degree ";
+    for (unsigned int i=0; i<ndegrees.size(); i++) info << (i ? "x" : "") << ndegrees[i]-1;
+    info << " (" << terms.size() << " coefficients)";
+    if (exact) info << " sampled from " << exact->getInfo();
+    return info.str();
+}
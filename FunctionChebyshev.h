@@ -0,0 +1,77 @@
+#ifndef FunctionChebyshev_H
+#define FunctionChebyshev_H
+
+#include <vector>
+#include <memory>
+#include "FunctionApproximation.h"
+
+//  -------------------------------------------------------------------------------------------
+//! Function approximated by a 1D/2D/3D tensor-product Chebyshev expansion on a box: the exact function
+//! is sampled once on the Chebyshev points of the box (one valuesAtGrid), the coefficients are computed
+//! by a cosine transform along each variable, and only the significant ones are kept: for each degree
+//! along the first variables (a row), the coefficients along the last variable up to the last significant
+//! one. For smooth profiles the rows fill a corner of the tensor, close to a total-degree set.
+//! A point costs the Chebyshev polynomials along each variable (one recurrence up to the highest kept
+//! degree) and one dot product per row (getCost multiply-adds); batches are evaluated by blocks of points.
+//! Points outside the box are passed to the exact function.
+//  -------------------------------------------------------------------------------------------
+class Function_Chebyshev final : public Function_Approximation
+{
+public:
+    //! Expansion of the exact function on [xmin[0], xmax[0]] x [xmin[1], xmax[1]] x ...,
+    //! sampled on ncoefficients[i] Chebyshev points along variable i (degree ncoefficients[i]-1)
+    Function_Chebyshev(Function *exact, std::vector<double> xmin, std::vector<double> xmax, std::vector<unsigned int> ncoefficients);
+    ~Function_Chebyshev();
+
+    double valueAt(const double *); // space
+    void valuesAt(const std::vector<double*> &, unsigned int, double *);
+    std::string getInfo();
+
+    //! Whether the last coefficients along each variable are below tolerance (relative to the largest
+    //! sampled value), i.e. the degree along it is high enough (before truncate)
+    std::vector<bool> resolved(double tolerance);
+
+    //! Drops the smallest coefficients as long as the sum of the dropped ones stays below tolerance/2
+    //! (relative to the largest sampled value), then keeps the rows of the others
+    void truncate(double tolerance);
+
+    //! Largest difference with the exact function on nsamples random points of the box,
+    //! relative to the largest exact value
+    double maxError(unsigned int nsamples);
+
+    //! Multiply-adds per point inside the box: the polynomials along each variable and the kept rows
+    inline size_t getCost() {
+        return terms.size() + (row_start.size()-1) * (ndegrees.size()-1) + npolynomials;
+    };
+
+    //! Largest number of sampled points, and of coefficients along one variable, when raising the degree
+    static const size_t max_size = 1<<21;
+    static const unsigned int max_ncoefficients = 1024;
+
+private:
+    //! whether x is inside the box
+    bool inside(const double * x);
+    //! keeps the coefficients of the tensor but the smallest ones adding up to at most threshold
+    void keep(double threshold);
+    //! expansion at npoints points inside the box (t[i*stride+p] is the coordinate i of point p mapped to [-1,1]),
+    //! polynomials holding npolynomials*npoints values
+    void sums(const double * t, unsigned int stride, unsigned int npoints, double * values, double * polynomials);
+
+    //! Box, and its center and inverse half-width along each variable
+    std::vector<double> xmin, xmax, center, inv_half;
+    //! Coefficients of the sampled tensor (row-major, until truncate) and their number along each variable
+    std::vector<double> coefficients;
+    std::vector<unsigned int> ncoefficients;
+    //! Kept rows: the coefficients of row r are terms[row_start[r]] to terms[row_start[r+1]-1] (degrees 0, 1, ...
+    //! along the last variable), multiplied by the polynomials row_polynomials[r*(ndim-1)+i] along the first ones,
+    //! indices among the npolynomials ones (those of variable i start at first[i], degree 0 to ndegrees[i]-1)
+    std::vector<double> terms;
+    std::vector<size_t> row_start;
+    std::vector<unsigned int> row_polynomials;
+    std::vector<unsigned int> ndegrees, first;
+    unsigned int npolynomials;
+    //! Largest sampled value
+    double scale;
+};
+
+#endif
@@ -0,0 +1,164 @@
+#include <cmath>
+#include <map>
+
+#include "FunctionExpression.h"
+
+using namespace std;
+
+map<string, Function_Expression::Opcode> Function_Expression::opcodeNames()
+{
+    const char * names[] = {
+        "const", "var", "neg",
+        "add", "sub", "mul", "div", "pow", "floordiv", "mod", "atan2",
+        "lt", "le", "gt", "ge", "eq", "ne", "and", "or",
+        "select",
+        "exp", "log", "log10", "sqrt", "sin", "cos", "tan", "sinh", "cosh", "tanh",
+        "asin", "acos", "atan", "floor", "ceil", "abs"
+    };
+    map<string, Opcode> opcodes;
+    for (unsigned int i=0; i<sizeof(names)/sizeof(names[0]); i++) opcodes[names[i]] = (Opcode) i;
+    return opcodes;
+}
+
+Function_Expression * Function_Expression::create(PyObject *py_profile, unsigned int nvariables)
+{
+    static const map<string, Opcode> opcodes = opcodeNames();
+    
+    // Translate in python
+    PyObject *translator = PyObject_GetAttrString(PyImport_AddModule("__main__"), "_compile_profile");
+    PyTools::checkPyError();
+    if (!translator) return NULL;
+    PyObject *py_program = PyObject_CallFunctionObjArgs(translator, py_profile, NULL);
+    PyTools::checkPyError();
+    Py_DECREF(translator);
+    
+    vector<PyObject*> py_instructions;
+    bool success = py_program && py_program != Py_None && PyTools::convert(py_program, py_instructions);
+    vector<Instruction> program(py_instructions.size());
+    int size = 0, depth = 0;
+    for (unsigned int i=0; success && i<py_instructions.size(); i++) {
+        string name;
+        success = PyTuple_Check(py_instructions[i]) && PyTuple_Size(py_instructions[i]) == 2
+            && PyTools::convert(PyTuple_GetItem(py_instructions[i], 0), name)
+            && PyTools::convert(PyTuple_GetItem(py_instructions[i], 1), program[i].value)
+            && opcodes.count(name);
+        if (!success) break;
+        program[i].op = opcodes.find(name)->second;
+        // Verify the stack usage
+        Opcode op = program[i].op;
+        if      (op == op_const)  size++;
+        else if (op == op_var)    size++, success = program[i].value >= 0 && program[i].value < nvariables;
+        else if (op == op_select) size -= 2;
+        else if (op >= op_add && op < op_select) size--;
+        if (size < 1) success = false;
+        depth = max(depth, size);
+    }
+    Py_XDECREF(py_program);
+    if (!success || size != 1) return NULL;
+    return new Function_Expression(program, depth, nvariables);
+}
+
+double Function_Expression::valueAt(const double * x)
+{
+    double value;
+    const double * coordinates[Profile::max_variables];
+    for (unsigned int i=0; i<nvariables; i++) coordinates[i] = x+i;
+    if (depth <= max_scalar_depth) {
+        double stack[max_scalar_depth];
+        run(coordinates, 0, 1, 1, stack, &value);
+    } else {
+        vector<double> stack(depth);
+        run(coordinates, 0, 1, 1, &stack[0], &value);
+    }
+    return value;
+}
+
+// Each instruction is applied to a whole chunk of points before the next one
+void Function_Expression::valuesAt(const vector<double*> &coordinates, unsigned int npoints, double * values)
+{
+    if (npoints == 0) return;
+    const unsigned int c = min((unsigned int) chunk, npoints);
+    vector<double> stack(depth * c);
+    for (unsigned int start=0; start<npoints; start+=c) {
+        run(&coordinates[0], start, min(c, npoints-start), c, &stack[0], values+start);
+    }
+}
+
+void Function_Expression::run(const double * const * coordinates, unsigned int start, unsigned int n, unsigned int c, double * stack, double * values)
+{
+    double * top = NULL; // top of the stack
+    for (unsigned int k=0; k<program.size(); k++) {
+        const Instruction & ins = program[k];
+        double * a = top ? top - c : NULL; // operand below the top
+        double * r = top;
+        switch (ins.op) {
+        case op_const:
+            top = top ? top+c : stack;
+            for (unsigned int p=0; p<n; p++) top[p] = ins.value;
+            break;
+        case op_var: {
+            top = top ? top+c : stack;
+            const double * x = coordinates[(unsigned int) ins.value] + start;
+            for (unsigned int p=0; p<n; p++) top[p] = x[p];
+            break;
+        }
+        case op_neg:   for (unsigned int p=0; p<n; p++) r[p] = -r[p]; break;
+        case op_add:   for (unsigned int p=0; p<n; p++) a[p] += r[p]; top = a; break;
+        case op_sub:   for (unsigned int p=0; p<n; p++) a[p] -= r[p]; top = a; break;
+        case op_mul:   for (unsigned int p=0; p<n; p++) a[p] *= r[p]; top = a; break;
+        case op_div:   for (unsigned int p=0; p<n; p++) a[p] /= r[p]; top = a; break;
+        case op_pow:
+            for (unsigned int p=0; p<n; p++) {
+                // integer powers are frequent (x**2)
+                if      (r[p] == 2.) a[p] *= a[p];
+                else if (r[p] == 1.) ;
+                else                 a[p] = pow(a[p], r[p]);
+            }
+            top = a;
+            break;
+        case op_floordiv: for (unsigned int p=0; p<n; p++) a[p] = floor(a[p] / r[p]); top = a; break;
+        case op_mod:   for (unsigned int p=0; p<n; p++) a[p] = a[p] - r[p] * floor(a[p] / r[p]); top = a; break;
+        case op_atan2: for (unsigned int p=0; p<n; p++) a[p] = atan2(a[p], r[p]); top = a; break;
+        case op_lt:    for (unsigned int p=0; p<n; p++) a[p] = a[p] <  r[p]; top = a; break;
+        case op_le:    for (unsigned int p=0; p<n; p++) a[p] = a[p] <= r[p]; top = a; break;
+        case op_gt:    for (unsigned int p=0; p<n; p++) a[p] = a[p] >  r[p]; top = a; break;
+        case op_ge:    for (unsigned int p=0; p<n; p++) a[p] = a[p] >= r[p]; top = a; break;
+        case op_eq:    for (unsigned int p=0; p<n; p++) a[p] = a[p] == r[p]; top = a; break;
+        case op_ne:    for (unsigned int p=0; p<n; p++) a[p] = a[p] != r[p]; top = a; break;
+        // python "and"/"or" return one of their operands
+        case op_and:   for (unsigned int p=0; p<n; p++) a[p] = a[p] != 0. ? r[p] : a[p]; top = a; break;
+        case op_or:    for (unsigned int p=0; p<n; p++) a[p] = a[p] != 0. ? a[p] : r[p]; top = a; break;
+        case op_select: {
+            // condition, value if true, value if false
+            double * t = a - c;
+            for (unsigned int p=0; p<n; p++) t[p] = t[p] != 0. ? a[p] : r[p];
+            top = t;
+            break;
+        }
+        case op_exp:   for (unsigned int p=0; p<n; p++) r[p] = exp  (r[p]); break;
+        case op_log:   for (unsigned int p=0; p<n; p++) r[p] = log  (r[p]); break;
+        case op_log10: for (unsigned int p=0; p<n; p++) r[p] = log10(r[p]); break;
+        case op_sqrt:  for (unsigned int p=0; p<n; p++) r[p] = sqrt (r[p]); break;
+        case op_sin:   for (unsigned int p=0; p<n; p++) r[p] = sin  (r[p]); break;
+        case op_cos:   for (unsigned int p=0; p<n; p++) r[p] = cos  (r[p]); break;
+        case op_tan:   for (unsigned int p=0; p<n; p++) r[p] = tan  (r[p]); break;
+        case op_sinh:  for (unsigned int p=0; p<n; p++) r[p] = sinh (r[p]); break;
+        case op_cosh:  for (unsigned int p=0; p<n; p++) r[p] = cosh (r[p]); break;
+        case op_tanh:  for (unsigned int p=0; p<n; p++) r[p] = tanh (r[p]); break;
+        case op_asin:  for (unsigned int p=0; p<n; p++) r[p] = asin (r[p]); break;
+        case op_acos:  for (unsigned int p=0; p<n; p++) r[p] = acos (r[p]); break;
+        case op_atan:  for (unsigned int p=0; p<n; p++) r[p] = atan (r[p]); break;
+        case op_floor: for (unsigned int p=0; p<n; p++) r[p] = floor(r[p]); break;
+        case op_ceil:  for (unsigned int p=0; p<n; p++) r[p] = ceil (r[p]); break;
+        case op_abs:   for (unsigned int p=0; p<n; p++) r[p] = abs  (r[p]); break;
+        }
+    }
+    for (unsigned int p=0; p<n; p++) values[p] = top[p];
+}
+
+string Function_Expression::getInfo()
+{
+    ostringstream info;
+    info << "compiled expression (" << program.size() << " instructions)";
+    return info.str();
+}
@@ -0,0 +1,66 @@
+#ifndef FunctionExpression_H
+#define FunctionExpression_H
+
+#include <vector>
+#include <string>
+#include <map>
+#include "Profile.h"
+
+//  -------------------------------------------------------------------------------------------
+//! Simple python function translated into a stack program (see _compile_profile in
+//! pyprofiles.py) and evaluated in C++, when the namelist sets `compile = True` on it.
+//! Numbers captured from the namelist (globals, closures) are frozen when the profile is created,
+//! and the errors of python are not raised: e.g. a division by zero gives inf instead of
+//! ZeroDivisionError, a negative number to a fractional power gives nan.
+//  -------------------------------------------------------------------------------------------
+class Function_Expression final : public Function
+{
+public:
+    //! Translate a python function with nvariables arguments, returns NULL if not supported
+    static Function_Expression * create(PyObject *py_profile, unsigned int nvariables);
+    
+    double valueAt(const double *); // space
+    void valuesAt(const std::vector<double*> &, unsigned int, double *);
+    std::string getInfo();
+    bool usesPython() {
+        return false;
+    };
+    
+    //! Number of points evaluated together by each instruction in valuesAt
+    static const unsigned int chunk = 256;
+    
+private:
+    enum Opcode {
+        op_const, op_var, op_neg,
+        op_add, op_sub, op_mul, op_div, op_pow, op_floordiv, op_mod, op_atan2,
+        op_lt, op_le, op_gt, op_ge, op_eq, op_ne, op_and, op_or,
+        op_select,
+        op_exp, op_log, op_log10, op_sqrt, op_sin, op_cos, op_tan, op_sinh, op_cosh, op_tanh,
+        op_asin, op_acos, op_atan, op_floor, op_ceil, op_abs
+    };
+    struct Instruction {
+        Opcode op;
+        double value; // constant, or variable index
+    };
+    
+    Function_Expression(std::vector<Instruction> p, unsigned int d, unsigned int nv) : program(p), depth(d), nvariables(nv) {};
+    
+    //! Runs the program on the n points start, start+1, ... of the coordinates, with a stack
+    //! of depth x c values, and puts the results in values[0 .. n-1]
+    void run(const double * const * coordinates, unsigned int start, unsigned int n, unsigned int c, double * stack, double * values);
+    
+    //! Largest stack evaluated on one point without allocation
+    static const unsigned int max_scalar_depth = 32;
+    
+    //! Opcodes of the instructions produced by _compile_profile
+    static std::map<std::string, Opcode> opcodeNames();
+    
+    //! Instructions in postfix order
+    std::vector<Instruction> program;
+    //! Size of the stack needed by the program
+    unsigned int depth;
+    //! Number of variables
+    unsigned int nvariables;
+};
+
+#endif
@@ -0,0 +1,159 @@
+#include <algorithm>
+
+#include "FunctionNative.h"
+
+using namespace std;
+
+Function * Function_Native::create(PyObject *py_profile, unsigned int &nvariables)
+{
+    string native;
+    vector<double> params;
+    unsigned int axis = 0;
+    vector<PyObject*> py_children;
+    if (!PyTools::getAttr(py_profile, "_native", native)
+        || !PyTools::getAttr(py_profile, "dim", nvariables)
+        || !PyTools::getAttr(py_profile, "axis", axis) ) {
+        ERROR("Native profile: not understood");
+        return NULL;
+    }
+    PyTools::getAttr(py_profile, "params", params);
+    PyTools::getAttr(py_profile, "children", py_children);
+    
+    // Build the children first
+    vector<Function*> children(py_children.size());
+    for (unsigned int i=0; i<py_children.size(); i++) {
+        unsigned int nv;
+        children[i] = create(py_children[i], nv);
+        if (!children[i]) {
+            for (unsigned int j=0; j<i; j++) delete children[j];
+            return NULL;
+        }
+    }
+    
+    Function * function = NULL;
+    if      (native == "constant"    && params.size() == 1) function = new Function_Constant(params[0]);
+    else if (native == "gaussian"    && params.size() == 4) function = new Function_Gaussian(axis, params[0], params[1], params[2], (unsigned int)params[3]);
+    else if (native == "trapezoidal" && params.size() == 5) function = new Function_Trapezoidal(axis, params[0], params[1], params[2], params[3], params[4]);
+    else if (native == "polynomial"  && params.size() >= 1) function = new Function_Polynomial(axis, params[0], vector<double>(params.begin()+1, params.end()));
+    else if (native == "cosine"      && params.size() == 6) function = new Function_Cosine(axis, params[0], params[1], params[2], params[3], params[4], params[5]);
+    else if (native == "sum"         && children.size() >= 1) function = new Function_Sum(children);
+    else if (native == "product"     && children.size() >= 1) function = new Function_Product(children);
+    else if (native == "shift"       && children.size() == 1) function = new Function_Shift(children[0], params, nvariables);
+    else if (native == "scale"       && children.size() == 1 && params.size() == 1) function = new Function_Scale(children[0], params[0]);
+    else {
+        ERROR("Native profile: " << native << " not understood");
+        for (unsigned int j=0; j<children.size(); j++) delete children[j];
+    }
+    return function;
+}
+
+
+// Batched evaluations: simple loops over contiguous coordinates (see also Function_Shape)
+
+void Function_Constant::valuesAt(const vector<double*> &, unsigned int npoints, double * values)
+{
+    fill(values, values+npoints, value);
+}
+
+
+Function_Sum::~Function_Sum()
+{
+    for (unsigned int i=0; i<children.size(); i++) delete children[i];
+}
+
+double Function_Sum::valueAt(const double * x)
+{
+    double v = 0.;
+    for (unsigned int i=0; i<children.size(); i++) v += children[i]->valueAt(x);
+    return v;
+}
+
+void Function_Sum::valuesAt(const vector<double*> &coordinates, unsigned int npoints, double * values)
+{
+    if (npoints == 0) return;
+    children[0]->valuesAt(coordinates, npoints, values);
+    vector<double> buffer(children.size()>1 ? npoints : 0);
+    for (unsigned int i=1; i<children.size(); i++) {
+        children[i]->valuesAt(coordinates, npoints, &buffer[0]);
+        for (unsigned int p=0; p<npoints; p++) values[p] += buffer[p];
+    }
+}
+
+
+Function_Product::~Function_Product()
+{
+    for (unsigned int i=0; i<children.size(); i++) delete children[i];
+}
+
+double Function_Product::valueAt(const double * x)
+{
+    double v = 1.;
+    for (unsigned int i=0; i<children.size(); i++) v *= children[i]->valueAt(x);
+    return v;
+}
+
+void Function_Product::valuesAt(const vector<double*> &coordinates, unsigned int npoints, double * values)
+{
+    if (npoints == 0) return;
+    children[0]->valuesAt(coordinates, npoints, values);
+    vector<double> buffer(children.size()>1 ? npoints : 0);
+    for (unsigned int i=1; i<children.size(); i++) {
+        children[i]->valuesAt(coordinates, npoints, &buffer[0]);
+        for (unsigned int p=0; p<npoints; p++) values[p] *= buffer[p];
+    }
+}
+
+
+double Function_Shift::valueAt(const double * x)
+{
+    double shifted[Profile::max_variables];
+    for (unsigned int i=0; i<nvariables; i++) shifted[i] = i<offsets.size() ? x[i] - offsets[i] : x[i];
+    return child->valueAt(shifted);
+}
+
+void Function_Shift::valuesAt(const vector<double*> &coordinates, unsigned int npoints, double * values)
+{
+    if (npoints == 0) return;
+    unsigned int nshift = min(coordinates.size(), offsets.size());
+    vector<vector<double> > buffer(nshift, vector<double>(npoints));
+    vector<double*> shifted(coordinates);
+    for (unsigned int i=0; i<nshift; i++) {
+        const double * x = coordinates[i];
+        double * y = &buffer[i][0];
+        for (unsigned int p=0; p<npoints; p++) y[p] = x[p] - offsets[i];
+        shifted[i] = y;
+    }
+    child->valuesAt(shifted, npoints, values);
+}
+
+
+void Function_Scale::valuesAt(const vector<double*> &coordinates, unsigned int npoints, double * values)
+{
+    child->valuesAt(coordinates, npoints, values);
+    for (unsigned int p=0; p<npoints; p++) values[p] *= factor;
+}
+
+
+string Function_Sum::getInfo()
+{
+    string info = "native sum of (";
+    for (unsigned int i=0; i<children.size(); i++) info += (i ? ", " : "") + children[i]->getInfo();
+    return info + ")";
+}
+
+string Function_Product::getInfo()
+{
+    string info = "native product of (";
+    for (unsigned int i=0; i<children.size(); i++) info += (i ? ", " : "") + children[i]->getInfo();
+    return info + ")";
+}
+
+string Function_Shift::getInfo()
+{
+    return "shifted " + child->getInfo();
+}
+
+string Function_Scale::getInfo()
+{
+    return "scaled " + child->getInfo();
+}
@@ -0,0 +1,203 @@
+#ifndef FunctionNative_H
+#define FunctionNative_H
+
+#include <vector>
+#include <string>
+#include <cmath>
+#include "Profile.h"
+
+//  -------------------------------------------------------------------------------------------
+//! Profiles evaluated in C++ without the interpreter, declared in the namelist
+//! with the tagged python objects of pyprofiles.py (constant, gaussian, ...)
+//  -------------------------------------------------------------------------------------------
+class Function_Native : public Function
+{
+public:
+    //! Build the C++ function from a tagged python object, and get its number of variables
+    //! (returns NULL if the object is not understood)
+    static Function * create(PyObject *py_profile, unsigned int &nvariables);
+    bool usesPython() {
+        return false;
+    };
+};
+
+
+// Shapes along one variable (axis)
+
+//! Derived::eval(x) applied to the coordinate axis (the loops call eval directly, so that it is inlined)
+template <class Derived>
+class Function_Shape : public Function_Native
+{
+public:
+    Function_Shape(unsigned int a) : axis(a) {};
+    double valueAt(const double * x) {
+        return static_cast<const Derived *>(this)->eval(x[axis]);
+    };
+    void valuesAt(const std::vector<double*> &coordinates, unsigned int npoints, double * values) {
+        const Derived * shape = static_cast<const Derived *>(this);
+        const double * x = coordinates[axis];
+        for (unsigned int p=0; p<npoints; p++) values[p] = shape->eval(x[p]);
+    };
+protected:
+    unsigned int axis;
+};
+
+
+class Function_Constant final : public Function_Native
+{
+public:
+    Function_Constant(double v) : value(v) {};
+    double valueAt(const double *) {
+        return value;
+    };
+    void valuesAt(const std::vector<double*> &, unsigned int, double *);
+    std::string getInfo() {
+        return "native constant";
+    };
+private:
+    double value;
+};
+
+
+class Function_Gaussian final : public Function_Shape<Function_Gaussian>
+{
+public:
+    Function_Gaussian(unsigned int a, double m, double c, double fwhm, unsigned int o) :
+        Function_Shape(a), max(m), center(c), inv_halfwidth(2./fwhm), order(o) {};
+    std::string getInfo() {
+        return "native gaussian";
+    };
+    inline double eval(double x) const {
+        double u = (x-center) * inv_halfwidth;
+        u *= u;
+        double p = u;
+        for (unsigned int i=1; i<order; i++) p *= u;
+        return max * std::exp(-M_LN2 * p);
+    };
+private:
+    double max, center, inv_halfwidth;
+    unsigned int order;
+};
+
+
+class Function_Trapezoidal final : public Function_Shape<Function_Trapezoidal>
+{
+public:
+    Function_Trapezoidal(unsigned int a, double m, double vacuum, double plateau, double slope1, double slope2) :
+        Function_Shape(a), max(m), x0(vacuum), x1(vacuum+slope1), x2(vacuum+slope1+plateau), x3(vacuum+slope1+plateau+slope2),
+        inv_slope1(slope1>0. ? m/slope1 : 0.), inv_slope2(slope2>0. ? m/slope2 : 0.) {};
+    std::string getInfo() {
+        return "native trapezoidal";
+    };
+    inline double eval(double x) const {
+        if (x < x0) return 0.;
+        if (x < x1) return (x-x0) * inv_slope1;
+        if (x <= x2) return max;
+        if (x < x3) return (x3-x) * inv_slope2;
+        return 0.;
+    };
+private:
+    double max, x0, x1, x2, x3, inv_slope1, inv_slope2;
+};
+
+
+class Function_Polynomial final : public Function_Shape<Function_Polynomial>
+{
+public:
+    Function_Polynomial(unsigned int a, double c, std::vector<double> coeffs) :
+        Function_Shape(a), center(c), coefficients(coeffs) {};
+    std::string getInfo() {
+        return "native polynomial";
+    };
+    inline double eval(double x) const {
+        double v = 0.;
+        x -= center;
+        for (int i=coefficients.size()-1; i>=0; i--) v = v*x + coefficients[i];
+        return v;
+    };
+private:
+    double center;
+    std::vector<double> coefficients;
+};
+
+
+class Function_Cosine final : public Function_Shape<Function_Cosine>
+{
+public:
+    Function_Cosine(unsigned int a, double b, double amp, double vacuum, double length, double p, double number) :
+        Function_Shape(a), base(b), amplitude(amp), x0(vacuum), x1(vacuum+length), phi(p), k(2.*M_PI*number/length) {};
+    std::string getInfo() {
+        return "native cosine";
+    };
+    inline double eval(double x) const {
+        if (x < x0 || x > x1) return 0.;
+        return base + amplitude * std::cos(phi + k*(x-x0));
+    };
+private:
+    double base, amplitude, x0, x1, phi, k;
+};
+
+
+// Combinations of other functions (which are owned)
+
+class Function_Sum final : public Function_Native
+{
+public:
+    Function_Sum(std::vector<Function*> c) : children(c) {};
+    ~Function_Sum();
+    double valueAt(const double *);
+    void valuesAt(const std::vector<double*> &, unsigned int, double *);
+    std::string getInfo();
+private:
+    std::vector<Function*> children;
+};
+
+
+class Function_Product final : public Function_Native
+{
+public:
+    Function_Product(std::vector<Function*> c) : children(c) {};
+    ~Function_Product();
+    double valueAt(const double *);
+    void valuesAt(const std::vector<double*> &, unsigned int, double *);
+    std::string getInfo();
+private:
+    std::vector<Function*> children;
+};
+
+
+class Function_Shift final : public Function_Native
+{
+public:
+    Function_Shift(Function *c, std::vector<double> o, unsigned int nv) : child(c), offsets(o), nvariables(nv) {};
+    ~Function_Shift() {
+        delete child;
+    };
+    double valueAt(const double *);
+    void valuesAt(const std::vector<double*> &, unsigned int, double *);
+    std::string getInfo();
+private:
+    Function *child;
+    std::vector<double> offsets;
+    unsigned int nvariables;
+};
+
+
+class Function_Scale final : public Function_Native
+{
+public:
+    Function_Scale(Function *c, double f) : child(c), factor(f) {};
+    ~Function_Scale() {
+        delete child;
+    };
+    double valueAt(const double * x) {
+        return factor * child->valueAt(x);
+    };
+    void valuesAt(const std::vector<double*> &, unsigned int, double *);
+    std::string getInfo();
+private:
+    Function *child;
+    double factor;
+};
+
+#endif
@@ -0,0 +1,187 @@
+#include <cmath>
+#include <algorithm>
+#include <functional>
+
+#include "FunctionTabulated.h"
+
+using namespace std;
+
+Function_Tabulated::Function_Tabulated(Function *ex, vector<vector<double> > ax, unsigned int o) :
+    Function_Approximation(ex),
+    order(o),
+    axes(ax)
+{
+    nvalues = setAxes();
+    data = NULL;
+    if (nvalues == 0) return;
+    table.resize(nvalues);
+    exact->valuesAtGrid(axes, &table[0], layout_rowMajor, 65536);
+    data = &table[0];
+}
+
+Function_Tabulated::Function_Tabulated(vector<vector<double> > ax, const double * values, unsigned int o) :
+    Function_Approximation(NULL),
+    order(o),
+    axes(ax)
+{
+    nvalues = setAxes();
+    data = nvalues ? values : NULL;
+}
+
+size_t Function_Tabulated::setAxes()
+{
+    if (order != 1 && order != 3) {
+        ERROR("Tabulated profile: order " << order << " not supported (1 or 3)");
+        order = 1;
+    }
+    // an invalid table has no values (0 is returned) and passes all the points to the exact function
+    unsigned int ndim = axes.size();
+    if (ndim < 1 || ndim > 3) {
+        ERROR("Tabulated profile: " << ndim << " variables not supported (1 to 3)");
+        return 0;
+    }
+    uniform.resize(ndim);
+    inv_dx.resize(ndim);
+    stride.resize(ndim);
+    size_t size = 1;
+    for (int i=ndim-1; i>=0; i--) {
+        if (axes[i].size() < 2 || adjacent_find(axes[i].begin(), axes[i].end(), greater_equal<double>()) != axes[i].end()) {
+            ERROR("Tabulated profile: axis " << i << " needs at least 2 increasing nodes");
+            return 0;
+        }
+        // cubic interpolation needs 4 nodes along each variable
+        if (axes[i].size() < 4) order = 1;
+        stride[i] = size;
+        size *= axes[i].size();
+        double dx = (axes[i].back()-axes[i].front()) / (axes[i].size()-1);
+        uniform[i] = true;
+        for (unsigned int j=0; j<axes[i].size(); j++) {
+            if (abs(axes[i][j] - axes[i].front() - j*dx) > 1e-10*abs(dx)*axes[i].size()) uniform[i] = false;
+        }
+        inv_dx[i] = 1./dx;
+    }
+    return size;
+}
+
+Function_Tabulated::~Function_Tabulated()
+{
+}
+
+bool Function_Tabulated::inside(const double * x)
+{
+    if (!data) return false;
+    for (unsigned int i=0; i<axes.size(); i++) {
+        if (!(x[i] >= axes[i].front() && x[i] <= axes[i].back())) return false;
+    }
+    return true;
+}
+
+double Function_Tabulated::interpolate(const double * x)
+{
+    unsigned int ndim = axes.size();
+    unsigned int m = order+1; // nodes in the stencil
+    size_t start[3];
+    double w[3][4];
+    for (unsigned int i=0; i<ndim; i++) {
+        const vector<double> & a = axes[i];
+        int n = a.size();
+        // cell containing x
+        int j;
+        if (uniform[i]) {
+            j = (int) ((x[i]-a[0]) * inv_dx[i]);
+        } else {
+            j = (int) (upper_bound(a.begin(), a.end(), x[i]) - a.begin()) - 1;
+        }
+        j = max(0, min(j, n-2));
+        if (order == 1) {
+            double t = (x[i]-a[j]) / (a[j+1]-a[j]);
+            w[i][0] = 1.-t;
+            w[i][1] = t;
+            start[i] = j;
+        } else {
+            int s = max(0, min(j-1, n-4));
+            for (unsigned int k=0; k<4; k++) {
+                double l = 1.;
+                for (unsigned int q=0; q<4; q++) {
+                    if (q != k) l *= (x[i]-a[s+q]) / (a[s+k]-a[s+q]);
+                }
+                w[i][k] = l;
+            }
+            start[i] = s;
+        }
+    }
+    double v = 0.;
+    if (ndim == 1) {
+        const double * t = &data[start[0]];
+        for (unsigned int a=0; a<m; a++) v += w[0][a] * t[a];
+    } else if (ndim == 2) {
+        for (unsigned int a=0; a<m; a++) {
+            const double * t = &data[(start[0]+a)*stride[0] + start[1]];
+            double v1 = 0.;
+            for (unsigned int b=0; b<m; b++) v1 += w[1][b] * t[b];
+            v += w[0][a] * v1;
+        }
+    } else {
+        for (unsigned int a=0; a<m; a++) {
+            double v1 = 0.;
+            for (unsigned int b=0; b<m; b++) {
+                const double * t = &data[(start[0]+a)*stride[0] + (start[1]+b)*stride[1] + start[2]];
+                double v2 = 0.;
+                for (unsigned int c=0; c<m; c++) v2 += w[2][c] * t[c];
+                v1 += w[1][b] * v2;
+            }
+            v += w[0][a] * v1;
+        }
+    }
+    return v;
+}
+
+double Function_Tabulated::valueAt(const double * x)
+{
+    if (inside(x)) return interpolate(x);
+    return exact ? exact->valueAt(x) : 0.;
+}
+
+void Function_Tabulated::valuesAt(const vector<double*> &coordinates, unsigned int npoints, double * values)
+{
+    if (!data) {
+        if (exact) exact->valuesAt(coordinates, npoints, values);
+        else fill(values, values+npoints, 0.);
+        return;
+    }
+    unsigned int ndim = axes.size();
+    double x[3];
+    // points outside of the table are gathered and evaluated at once by the exact function
+    vector<unsigned int> outside;
+    for (unsigned int p=0; p<npoints; p++) {
+        for (unsigned int i=0; i<ndim; i++) x[i] = coordinates[i][p];
+        if (inside(x)) {
+            values[p] = interpolate(x);
+        } else {
+            values[p] = 0.;
+            outside.push_back(p);
+        }
+    }
+    valuesOutside(coordinates, outside, values);
+}
+
+double Function_Tabulated::maxError(unsigned int nsamples)
+{
+    if (!data) return 0.;
+    vector<double> xmin(axes.size()), xmax(axes.size());
+    for (unsigned int i=0; i<axes.size(); i++) {
+        xmin[i] = axes[i].front();
+        xmax[i] = axes[i].back();
+    }
+    double scale = 0.;
+    for (size_t k=0; k<nvalues; k++) scale = max(scale, abs(data[k]));
+    return sampledError(xmin, xmax, nsamples, scale);
+}
+
+string Function_Tabulated::getInfo()
+{
+    ostringstream info;
+    info << (order==1 ? "linear" : "cubic") << " interpolation in a table of " << nvalues << " values";
+    if (exact) info << " sampled from " << exact->getInfo();
+    return info.str();
+}
@@ -0,0 +1,73 @@
+#ifndef FunctionTabulated_H
+#define FunctionTabulated_H
+
+#include <vector>
+#include <memory>
+#include "FunctionApproximation.h"
+
+//  -------------------------------------------------------------------------------------------
+//! Function sampled once on a 1D/2D/3D rectilinear table, then interpolated in C++
+//! (order 1: multilinear, order 3: 4-point Lagrange along each variable).
+//! Points outside the table are passed to the exact function.
+//  -------------------------------------------------------------------------------------------
+class Function_Tabulated final : public Function_Approximation
+{
+public:
+    //! Sample the exact function on the nodes axes[0] x axes[1] x ... (uniform or not)
+    Function_Tabulated(Function *exact, std::vector<std::vector<double> > axes, unsigned int order);
+    //! Table of row-major values given on the nodes, used in place (it must outlive the function).
+    //! There is no exact function: points outside the table give 0.
+    Function_Tabulated(std::vector<std::vector<double> > axes, const double * values, unsigned int order);
+    ~Function_Tabulated();
+    
+    double valueAt(const double *); // space
+    void valuesAt(const std::vector<double*> &, unsigned int, double *);
+    std::string getInfo();
+    
+    //! Whether the axes were accepted (1 to 3 variables, at least 2 increasing nodes along each)
+    inline bool isValid() {
+        return data != NULL;
+    };
+    
+    //! Largest difference with the exact function on nsamples random points of the table,
+    //! relative to the largest exact value
+    double maxError(unsigned int nsamples);
+    
+    //! Nodes, interpolation order and row-major values of the table
+    inline const std::vector<std::vector<double> > & getAxes() {
+        return axes;
+    };
+    inline unsigned int getOrder() {
+        return order;
+    };
+    inline const double * getValues() {
+        return data;
+    };
+    
+    //! Largest number of nodes allowed when refining a table
+    static const size_t max_size = 1<<24;
+    
+private:
+    //! checks the axes and computes the strides, returns the number of nodes
+    size_t setAxes();
+    //! interpolation at x, assumed to be inside the table
+    double interpolate(const double * x);
+    //! whether x is inside the table
+    bool inside(const double * x);
+    
+    //! Interpolation order
+    unsigned int order;
+    //! Nodes along each variable
+    std::vector<std::vector<double> > axes;
+    //! Whether the nodes are equally spaced along each variable, and their spacing
+    std::vector<bool> uniform;
+    std::vector<double> inv_dx;
+    //! Table of values (row-major), unless given at construction, and strides along each variable
+    std::vector<double> table;
+    std::vector<size_t> stride;
+    //! Values used for the interpolation (in the table, or given at construction)
+    const double * data;
+    size_t nvalues;
+};
+
+#endif
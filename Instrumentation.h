@@ -0,0 +1,194 @@
+#ifndef INSTRUMENTATION_H
+#define INSTRUMENTATION_H
+
+//  -------------------------------------------------------------------------------------------
+//! Optional measurement of the time spent in profiles and in namelist accesses
+//! (compile with -DNICO_INSTRUMENTATION, e.g. make INSTRUMENTATION=1).
+//!   INSTRUMENT_CALL(name)       times the enclosing scope as one call of the entry name
+//!   INSTRUMENT_PART(part)       times the enclosing scope as interpreter or conversion time
+//!                               of the calls being timed
+//!   INSTRUMENT_EXCEPTION(t, m)  counts a python exception that was not reported
+//!   INSTRUMENT_REPORT(out)      prints the counts and latencies of all the entries
+//! Without NICO_INSTRUMENTATION the macros expand to nothing (their arguments are not evaluated).
+//  -------------------------------------------------------------------------------------------
+
+#ifdef NICO_INSTRUMENTATION
+
+#include <map>
+#include <vector>
+#include <string>
+#include <mutex>
+#include <chrono>
+#include <iostream>
+#include <iomanip>
+#include <algorithm>
+
+class Instrumentation {
+public:
+    enum Part { part_interpreter, part_conversion };
+
+    //! Times one call of an entry during its lifetime
+    class Timer {
+    public:
+        Timer(const std::string &name, unsigned long long items=1) :
+            name(name), items(items), interpreter(0), conversion(0), parent(current()), start(now())
+        {
+            current() = this;
+        };
+        ~Timer() {
+            current() = parent;
+            add(name, items, now()-start, interpreter, conversion);
+            // the enclosing call includes this one
+            if (parent) {
+                parent->interpreter += interpreter;
+                parent->conversion += conversion;
+            }
+        };
+    private:
+        friend class Instrumentation;
+        std::string name;
+        unsigned long long items, interpreter, conversion;
+        Timer *parent;
+        unsigned long long start;
+    };
+
+    //! Adds its lifetime to the interpreter or conversion time of the innermost Timer
+    class PartTimer {
+    public:
+        PartTimer(Part part) : part(part), start(now()) {};
+        ~PartTimer() {
+            unsigned long long ns = now()-start;
+            Timer *timer = current();
+            if (!timer) {
+                // python called outside of any timed entry
+                if (part == part_interpreter) add("(other python calls)", 1, ns, ns, 0);
+                else                          add("(other python calls)", 0, ns, 0, ns);
+            } else if (part == part_interpreter) {
+                timer->interpreter += ns;
+            } else {
+                timer->conversion += ns;
+            }
+        };
+    private:
+        Part part;
+        unsigned long long start;
+    };
+
+    static void exception(const std::string &type, const std::string &message) {
+        State &s = state();
+        std::lock_guard<std::mutex> lock(s.mutex);
+        Exceptions &e = s.exceptions[type];
+        e.count++;
+        e.last_message = message;
+    }
+
+    //! Entries sorted by total time, with the latency percentiles of a call
+    static void report(std::ostream &out) {
+        State &s = state();
+        std::lock_guard<std::mutex> lock(s.mutex);
+        std::vector<std::pair<unsigned long long, std::string> > order;
+        for (std::map<std::string, Stats>::iterator it=s.stats.begin(); it!=s.stats.end(); it++) {
+            order.push_back(std::make_pair(it->second.total, it->first));
+        }
+        std::sort(order.rbegin(), order.rend());
+        out << "Instrumentation report (times in microseconds)" << std::endl;
+        out << std::left << std::setw(40) << "entry" << std::right << std::setw(10) << "calls" << std::setw(12) << "items"
+            << std::setw(14) << "total" << std::setw(10) << "mean" << std::setw(10) << "p50" << std::setw(10) << "p90"
+            << std::setw(10) << "p99" << std::setw(10) << "max" << std::setw(9) << "python" << std::setw(9) << "conv" << std::endl;
+        out << std::fixed << std::setprecision(1);
+        for (unsigned int i=0; i<order.size(); i++) {
+            Stats &st = s.stats[order[i].second];
+            std::vector<unsigned long long> samples = st.samples;
+            std::sort(samples.begin(), samples.end());
+            out << std::left << std::setw(40) << order[i].second << std::right << std::setw(10) << st.calls << std::setw(12) << st.items
+                << std::setw(14) << st.total*1e-3 << std::setw(10) << (st.calls ? st.total*1e-3/st.calls : 0.)
+                << std::setw(10) << percentile(samples, 0.5)*1e-3 << std::setw(10) << percentile(samples, 0.9)*1e-3
+                << std::setw(10) << percentile(samples, 0.99)*1e-3 << std::setw(10) << st.max*1e-3
+                << std::setw(8) << (st.total ? 100.*st.interpreter/st.total : 0.) << "%"
+                << std::setw(8) << (st.total ? 100.*st.conversion/st.total : 0.) << "%" << std::endl;
+        }
+        for (std::map<std::string, Exceptions>::iterator it=s.exceptions.begin(); it!=s.exceptions.end(); it++) {
+            out << "python exception " << it->first << " ignored " << it->second.count << " times, last: " << it->second.last_message << std::endl;
+        }
+        out << std::defaultfloat;
+    }
+
+private:
+    //! Number of call durations kept per entry for the percentiles (random sample beyond)
+    static const size_t max_samples = 8192;
+
+    struct Stats {
+        Stats() : calls(0), items(0), total(0), interpreter(0), conversion(0), max(0), seed(1) {};
+        unsigned long long calls, items, total, interpreter, conversion, max, seed;
+        std::vector<unsigned long long> samples;
+    };
+    struct Exceptions {
+        Exceptions() : count(0) {};
+        unsigned long long count;
+        std::string last_message;
+    };
+    struct State {
+        std::mutex mutex;
+        std::map<std::string, Stats> stats;
+        std::map<std::string, Exceptions> exceptions;
+    };
+
+    static State & state() {
+        static State s;
+        return s;
+    }
+
+    //! innermost Timer of this thread
+    static Timer *& current() {
+        static thread_local Timer *timer = NULL;
+        return timer;
+    }
+
+    static unsigned long long now() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    static void add(const std::string &name, unsigned long long items, unsigned long long ns,
+                    unsigned long long interpreter, unsigned long long conversion) {
+        State &s = state();
+        std::lock_guard<std::mutex> lock(s.mutex);
+        Stats &st = s.stats[name];
+        if (items) st.calls++;
+        st.items += items;
+        st.total += ns;
+        st.interpreter += interpreter;
+        st.conversion += conversion;
+        st.max = std::max(st.max, ns);
+        // reservoir sampling of the call durations
+        if (!items) {
+            return;
+        } else if (st.samples.size() < max_samples) {
+            st.samples.push_back(ns);
+        } else {
+            st.seed = st.seed * 6364136223846793005ULL + 1442695040888963407ULL;
+            unsigned long long k = (st.seed >> 17) % st.calls;
+            if (k < max_samples) st.samples[k] = ns;
+        }
+    }
+
+    static double percentile(const std::vector<unsigned long long> &sorted, double q) {
+        if (sorted.empty()) return 0.;
+        return sorted[std::min(sorted.size()-1, (size_t) (q*sorted.size()))];
+    }
+};
+
+#define INSTRUMENT_CALL(...) Instrumentation::Timer instrumentation_timer(__VA_ARGS__)
+#define INSTRUMENT_PART(part) Instrumentation::PartTimer instrumentation_part(Instrumentation::part)
+#define INSTRUMENT_EXCEPTION(type, message) Instrumentation::exception(type, message)
+#define INSTRUMENT_REPORT(out) Instrumentation::report(out)
+
+#else
+
+#define INSTRUMENT_CALL(...)
+#define INSTRUMENT_PART(part)
+#define INSTRUMENT_EXCEPTION(type, message)
+#define INSTRUMENT_REPORT(out)
+
+#endif
+
+#endif
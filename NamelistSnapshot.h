@@ -0,0 +1,314 @@
+#ifndef NAMELISTSNAPSHOT_H
+#define NAMELISTSNAPSHOT_H
+
+#include <map>
+#include <vector>
+#include <string>
+#include <sstream>
+#include <iostream>
+#include <fstream>
+#include <cstdio>
+#include <cstring>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// same as in PyTools.h, which this file does not need
+#ifndef ERROR
+#define ERROR(__txt) std::cout << "[ERROR] " << __FILE__ << ":" << __LINE__ << " (" << __FUNCTION__ << ") " << __txt << std::endl;
+#endif
+
+//  -------------------------------------------------------------------------------------------
+//! Binary snapshot of a namelist, so that a run can restart without the python interpreter.
+//! While recording, every value obtained by PyTools::extract / nComponents and every tabulated
+//! profile is kept; save() writes them to a versioned file. load() maps such a file in memory,
+//! then PyTools::extract and Profile are served from it (profiles as their interpolation table).
+//!
+//! File layout (native byte order, everything aligned on 8 bytes):
+//!   header: "NICOSNAP", uint32 version, uint32 byte order mark, uint64 number of entries
+//!   entries: uint32 kind, uint32 key length, uint64 count, key, data
+//!   (count doubles for numbers and tables, count chars for strings, lists of strings separated by '\0')
+//  -------------------------------------------------------------------------------------------
+class NamelistSnapshot {
+public:
+    enum Mode { mode_off, mode_recording, mode_replaying };
+    enum Kind { kind_numbers=1, kind_string=2, kind_table=3, kind_strings=4 };
+
+    static const uint32_t version = 1;
+
+    //! Keep the values extracted from now on
+    static void record() {
+        close();
+        state().mode = mode_recording;
+    }
+
+    inline static bool recording() {
+        return state().mode == mode_recording;
+    }
+
+    inline static bool replaying() {
+        return state().mode == mode_replaying;
+    }
+
+    //! Name of a value in the snapshot
+    static std::string key(std::string name, std::string component=std::string(""), int nComponent=0) {
+        if (component.empty()) return name;
+        std::ostringstream k;
+        k << component << "[" << nComponent << "]." << name;
+        return k.str();
+    }
+
+    //! Name of the number of components in the snapshot
+    static std::string componentsKey(std::string componentName) {
+        return "len(" + componentName + ")";
+    }
+
+    // Values recorded
+
+    template <typename T>
+    static void put(std::string key, const T & value) {
+        put(key, kind_numbers, std::vector<double>(1, (double) value));
+    }
+
+    template <typename T>
+    static void put(std::string key, const std::vector<T> & values) {
+        put(key, kind_numbers, std::vector<double>(values.begin(), values.end()));
+    }
+
+    static void put(std::string key, const std::string & value) {
+        Record & r = state().records[key];
+        r.kind = kind_string;
+        r.text = value;
+    }
+
+    //! strings separated by '\0'
+    static void put(std::string key, const std::vector<std::string> & values) {
+        std::string text;
+        for (unsigned int i=0; i<values.size(); i++) text += values[i] + std::string(1, '\0');
+        Record & r = state().records[key];
+        r.kind = kind_strings;
+        r.text = text;
+    }
+
+    //! Interpolation table: nodes along each variable, order, and row-major values
+    static void putTable(std::string key, const std::vector<std::vector<double> > & axes, unsigned int order, const double * values) {
+        std::vector<double> data;
+        data.push_back(axes.size());
+        data.push_back(order);
+        size_t size = 1;
+        for (unsigned int i=0; i<axes.size(); i++) {
+            data.push_back(axes[i].size());
+            size *= axes[i].size();
+        }
+        for (unsigned int i=0; i<axes.size(); i++) data.insert(data.end(), axes[i].begin(), axes[i].end());
+        data.insert(data.end(), values, values+size);
+        put(key, kind_table, data);
+    }
+
+    //! Write the recorded values, returns false on error
+    //! (defined in PyTools.h, after PyTools::writeFileAtomically)
+    static bool save(std::string fname);
+
+    //! Whether the file is a namelist snapshot
+    static bool isSnapshot(std::string fname) {
+        char magic[8];
+        std::ifstream in(fname.c_str(), std::ios::binary);
+        return in.read(magic, 8) && memcmp(magic, "NICOSNAP", 8) == 0;
+    }
+
+    //! Map a snapshot in memory and serve the values from it, returns false on error
+    static bool load(std::string fname) {
+        close();
+        int fd = ::open(fname.c_str(), O_RDONLY);
+        if (fd < 0) {
+            ERROR("Cannot open namelist snapshot " << fname);
+            return false;
+        }
+        struct stat st;
+        void * map = MAP_FAILED;
+        if (fstat(fd, &st) == 0 && st.st_size > 0) {
+            map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        }
+        ::close(fd);
+        if (map == MAP_FAILED) {
+            ERROR("Cannot map namelist snapshot " << fname);
+            return false;
+        }
+        State & s = state();
+        s.map = map;
+        s.map_size = st.st_size;
+
+        const char * begin = (const char *) map, * end = begin + st.st_size, * p = begin;
+        uint32_t header[2];
+        uint64_t nentries;
+        if (st.st_size < 24 || memcmp(p, "NICOSNAP", 8) != 0) {
+            ERROR(fname << " is not a namelist snapshot");
+            close();
+            return false;
+        }
+        memcpy(header, p+8, sizeof(header));
+        memcpy(&nentries, p+16, sizeof(nentries));
+        if (header[0] != version || header[1] != byte_order_mark) {
+            ERROR("Namelist snapshot " << fname << " has version " << header[0] << " (expected " << version << ") or another byte order");
+            close();
+            return false;
+        }
+        p += 24;
+        for (uint64_t e=0; e<nentries; e++) {
+            uint32_t entry[2];
+            uint64_t count;
+            if (end - p < 16) break;
+            memcpy(entry, p, sizeof(entry));
+            memcpy(&count, p+8, sizeof(count));
+            p += 16;
+            size_t key_size = padded(entry[1]);
+            size_t data_size = (entry[0] == kind_numbers || entry[0] == kind_table) ? count*sizeof(double) : padded(count);
+            if ((size_t)(end - p) < key_size || (size_t)(end - p) - key_size < data_size) break;
+            Entry & en = s.entries[std::string(p, entry[1])];
+            en.kind = entry[0];
+            en.count = count;
+            en.data = p + key_size;
+            p += key_size + data_size;
+        }
+        if (s.entries.size() != nentries) {
+            ERROR("Namelist snapshot " << fname << " is truncated");
+            close();
+            return false;
+        }
+        s.mode = mode_replaying;
+        return true;
+    }
+
+    //! Stop recording or replaying (the tables of the profiles built from the snapshot are released)
+    static void close() {
+        State & s = state();
+        if (s.map) munmap(s.map, s.map_size);
+        s.map = NULL;
+        s.map_size = 0;
+        s.entries.clear();
+        s.records.clear();
+        s.mode = mode_off;
+    }
+
+    // Values replayed
+
+    template <typename T>
+    static bool get(std::string key, T & value) {
+        const Entry * e = find(key, kind_numbers);
+        if (!e || e->count != 1) return false;
+        value = (T) ((const double *) e->data)[0];
+        return true;
+    }
+
+    template <typename T>
+    static bool get(std::string key, std::vector<T> & values) {
+        const Entry * e = find(key, kind_numbers);
+        if (!e) return false;
+        const double * data = (const double *) e->data;
+        values.resize(e->count);
+        for (size_t i=0; i<e->count; i++) values[i] = (T) data[i];
+        return true;
+    }
+
+    static bool get(std::string key, std::string & value) {
+        const Entry * e = find(key, kind_string);
+        if (!e) return false;
+        value.assign((const char *) e->data, e->count);
+        return true;
+    }
+
+    static bool get(std::string key, std::vector<std::string> & values) {
+        const Entry * e = find(key, kind_strings);
+        if (!e) return false;
+        values.clear();
+        const char * text = (const char *) e->data, * end = text + e->count;
+        while (text < end) {
+            values.push_back(std::string(text));
+            text += values.back().size() + 1;
+        }
+        return true;
+    }
+
+    //! Interpolation table of a profile; the values stay in the mapped file (valid until close)
+    static bool getTable(std::string key, std::vector<std::vector<double> > & axes, unsigned int & order, const double *& values) {
+        const Entry * e = find(key, kind_table);
+        if (!e || e->count < 2) return false;
+        const double * data = (const double *) e->data, * end = data + e->count;
+        unsigned int ndim = data[0];
+        order = data[1];
+        data += 2;
+        if (end - data < ndim) return false;
+        axes.resize(ndim);
+        size_t size = 1;
+        for (unsigned int i=0; i<ndim; i++) {
+            axes[i].resize((size_t) data[i]);
+            size *= axes[i].size();
+        }
+        data += ndim;
+        for (unsigned int i=0; i<ndim; i++) {
+            if ((size_t)(end - data) < axes[i].size()) return false;
+            axes[i].assign(data, data + axes[i].size());
+            data += axes[i].size();
+        }
+        if ((size_t)(end - data) != size) return false;
+        values = data;
+        return true;
+    }
+
+private:
+    static const uint32_t byte_order_mark = 0x01020304;
+
+    //! value being recorded
+    struct Record {
+        uint32_t kind;
+        std::vector<double> numbers;
+        std::string text;
+    };
+
+    //! value in the mapped file
+    struct Entry {
+        uint32_t kind;
+        uint64_t count;
+        const void * data;
+    };
+
+    struct State {
+        State() : mode(mode_off), map(NULL), map_size(0) {};
+        Mode mode;
+        std::map<std::string, Record> records;
+        std::map<std::string, Entry> entries;
+        void * map;
+        size_t map_size;
+    };
+
+    static State & state() {
+        static State s;
+        return s;
+    }
+
+    static void put(std::string key, uint32_t kind, const std::vector<double> & numbers) {
+        Record & r = state().records[key];
+        r.kind = kind;
+        r.numbers = numbers;
+    }
+
+    static const Entry * find(std::string key, uint32_t kind) {
+        std::map<std::string, Entry> & entries = state().entries;
+        std::map<std::string, Entry>::const_iterator it = entries.find(key);
+        if (it == entries.end() || it->second.kind != kind) return NULL;
+        return &it->second;
+    }
+
+    inline static size_t padded(size_t n) {
+        return (n + 7) & ~(size_t)7;
+    }
+
+    static void pad(std::ostream & out, size_t n) {
+        static const char zeros[8] = {0};
+        out.write(zeros, padded(n) - n);
+    }
+};
+
+#endif
@@ -0,0 +1,294 @@
+#include <atomic>
+#include <thread>
+#include <new>
+#include <cstdint>
+#include <cstdio>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "ParallelEvaluator.h"
+#include "ProfileFactorization.h"
+
+using namespace std;
+
+// Chunks of the grid are distributed among the workers as contiguous ranges, stored in one
+// atomic word each (first chunk in the low 32 bits, end of the range in the high 32 bits).
+// A worker takes chunks from the front of its own range and, when it is empty, steals chunks
+// from the back of the ranges of the other workers.
+
+static inline uint64_t packRange(uint32_t front, uint32_t end)
+{
+    return ((uint64_t)end << 32) | front;
+}
+
+static void initRanges(atomic<uint64_t> * ranges, unsigned int nworkers, uint32_t nchunks)
+{
+    for (unsigned int w=0; w<nworkers; w++) {
+        uint32_t front = (uint32_t) ((uint64_t)nchunks * w / nworkers);
+        uint32_t end   = (uint32_t) ((uint64_t)nchunks * (w+1) / nworkers);
+        ranges[w].store(packRange(front, end));
+    }
+}
+
+static bool nextChunk(atomic<uint64_t> * ranges, unsigned int nworkers, unsigned int worker, uint32_t &chunk)
+{
+    // own chunks, from the front
+    uint64_t r = ranges[worker].load();
+    while ((uint32_t)r < (uint32_t)(r>>32)) {
+        if (ranges[worker].compare_exchange_weak(r, packRange((uint32_t)r+1, (uint32_t)(r>>32)))) {
+            chunk = (uint32_t)r;
+            return true;
+        }
+    }
+    // steal from the back of the others
+    for (unsigned int k=1; k<nworkers; k++) {
+        unsigned int victim = (worker+k) % nworkers;
+        r = ranges[victim].load();
+        while ((uint32_t)r < (uint32_t)(r>>32)) {
+            if (ranges[victim].compare_exchange_weak(r, packRange((uint32_t)r, (uint32_t)(r>>32)-1))) {
+                chunk = (uint32_t)(r>>32)-1;
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+static void work(Function * function, const vector<vector<double> > &axes, double * values, ProfileLayout layout,
+                 unsigned int chunk_size, atomic<uint64_t> * ranges, unsigned int nworkers, unsigned int worker)
+{
+    uint32_t chunk;
+    while (nextChunk(ranges, nworkers, worker, chunk)) {
+        function->valuesAtGrid(axes, values, layout, chunk_size, (size_t)chunk*chunk_size, chunk_size);
+    }
+}
+
+
+ParallelEvaluator::ParallelEvaluator(unsigned int n) :
+    nworkers(n),
+    interpreters_failed(false)
+{
+    if (nworkers == 0) nworkers = max(1u, thread::hardware_concurrency());
+}
+
+ParallelEvaluator::~ParallelEvaluator()
+{
+    endInterpreters();
+}
+
+void ParallelEvaluator::endInterpreters()
+{
+    if (interpreters.empty() || !Py_IsInitialized()) return;
+    PyThreadState *main_state = PyEval_SaveThread();
+    for (unsigned int i=0; i<interpreters.size(); i++) {
+        PyEval_RestoreThread(interpreters[i]);
+        for (unsigned int j=0; j<interpreter_profiles[i].size(); j++) delete interpreter_profiles[i][j];
+        PyTools::clearComponents();
+        Py_EndInterpreter(interpreters[i]);
+    }
+    PyEval_RestoreThread(main_state);
+    interpreters.clear();
+    interpreter_profiles.clear();
+}
+
+void ParallelEvaluator::valuesAtGrid(Profile &profile, vector<vector<double> > axes, double * values,
+                                     ProfileLayout layout, unsigned int chunk_size)
+{
+    if (axes.size() != profile.nvariables || !profile.function) {
+        ERROR("Profile: grid has " << axes.size() << " axes but the profile has " << profile.nvariables << " variables");
+        return;
+    }
+    size_t npoints = 1;
+    for (unsigned int i=0; i<axes.size(); i++) npoints *= axes[i].size();
+    if (npoints == 0) return;
+    // chunks are numbered with 32 bits
+    if (chunk_size == 0) chunk_size = 1;
+    while ((npoints-1) / chunk_size >= 0xffffffffu) chunk_size *= 2;
+    
+    // a separable profile needs much fewer evaluations than the workers would share
+    if (profile.factorization && profile.factorization->valuesAtGrid(profile.function.get(), axes, values, layout, chunk_size)) {
+        info = "factorized";
+        return;
+    }
+    
+    if (nworkers > 1 && (npoints-1) / chunk_size > 0) {
+        if (evaluateThreads(profile, axes, values, layout, chunk_size)) return;
+        if (evaluateSubinterpreters(profile, axes, values, layout, chunk_size)) return;
+        if (evaluateProcesses(profile, axes, values, layout, chunk_size)) return;
+    }
+    info = "serial";
+    profile.valuesAtGrid(axes, values, layout, chunk_size);
+}
+
+// Functions that do not need python are shared by plain threads
+bool ParallelEvaluator::evaluateThreads(Profile &profile, const vector<vector<double> > &axes, double * values,
+                                        ProfileLayout layout, unsigned int chunk_size)
+{
+    if (profile.function->usesPython()) return false;
+    size_t npoints = 1;
+    for (unsigned int i=0; i<axes.size(); i++) npoints *= axes[i].size();
+    vector<atomic<uint64_t> > ranges(nworkers);
+    initRanges(&ranges[0], nworkers, (uint32_t)((npoints-1)/chunk_size+1));
+    vector<thread> threads;
+    for (unsigned int w=0; w<nworkers; w++) {
+        threads.push_back(thread(work, profile.function.get(), cref(axes), values, layout, chunk_size, &ranges[0], nworkers, w));
+    }
+    for (unsigned int w=0; w<nworkers; w++) threads[w].join();
+    info = to_string(nworkers) + " threads";
+    return true;
+}
+
+Profile * ParallelEvaluator::interpreterProfile(unsigned int i, Profile &profile)
+{
+    for (unsigned int j=0; j<interpreter_profiles[i].size(); j++) {
+        Profile * p = interpreter_profiles[i][j];
+        if (p->name == profile.name && p->component == profile.component && p->nComponent == profile.nComponent) return p;
+    }
+    Profile * p = new Profile(profile.name, profile.component, profile.nComponent, profile.spacetime);
+    interpreter_profiles[i].push_back(p);
+    return p;
+}
+
+// Python functions in threads, each with its own interpreter and GIL
+bool ParallelEvaluator::evaluateSubinterpreters(Profile &profile, const vector<vector<double> > &axes, double * values,
+                                                ProfileLayout layout, unsigned int chunk_size)
+{
+#if PY_VERSION_HEX >= 0x030C0000
+    // Only plain python profiles can be rebuilt from the namelist
+    if (interpreters_failed || PyTools::namelist().empty() || !profile.in_namelist
+        || !dynamic_cast<Function_Python*>(profile.function.get())) return false;
+    
+    PyThreadState *main_state = PyThreadState_Get();
+    // Start the interpreters and execute the namelist in each of them
+    while (interpreters.size() < nworkers && !interpreters_failed) {
+        PyInterpreterConfig config;
+        memset(&config, 0, sizeof(config));
+        config.use_main_obmalloc = 0;
+        config.allow_fork = 0;
+        config.allow_exec = 0;
+        config.allow_threads = 1;
+        config.allow_daemon_threads = 0;
+        config.check_multi_interp_extensions = 1;
+        config.gil = PyInterpreterConfig_OWN_GIL;
+        PyThreadState *state = NULL;
+        PyStatus status = Py_NewInterpreterFromConfig(&state, &config);
+        if (PyStatus_Exception(status) || !state) {
+            interpreters_failed = true;
+            break;
+        }
+        PyTools::initInterpreter();
+        interpreters_failed = !PyTools::execFile(PyTools::namelist());
+        interpreters.push_back(state);
+        interpreter_profiles.push_back(vector<Profile*>());
+        PyEval_SaveThread();
+        PyEval_RestoreThread(main_state);
+    }
+    
+    // The equivalent profile in each interpreter
+    vector<Function*> functions(nworkers, NULL);
+    for (unsigned int i=0; i<interpreters.size() && !interpreters_failed; i++) {
+        PyEval_SaveThread();
+        PyEval_RestoreThread(interpreters[i]);
+        Profile * p = interpreterProfile(i, profile);
+        PyEval_SaveThread();
+        PyEval_RestoreThread(main_state);
+        if (!p->function || p->nvariables != profile.nvariables) interpreters_failed = true;
+        functions[i] = p->function.get();
+    }
+    if (interpreters_failed) {
+        ERROR("Sub-interpreters could not evaluate " << profile.name << ": using processes");
+        return false;
+    }
+    
+    size_t npoints = 1;
+    for (unsigned int i=0; i<axes.size(); i++) npoints *= axes[i].size();
+    vector<atomic<uint64_t> > ranges(nworkers);
+    initRanges(&ranges[0], nworkers, (uint32_t)((npoints-1)/chunk_size+1));
+    PyEval_SaveThread();
+    vector<thread> threads;
+    for (unsigned int w=0; w<nworkers; w++) {
+        threads.push_back(thread([&, w]() {
+            PyThreadState *state = PyThreadState_New(interpreters[w]->interp);
+            PyEval_RestoreThread(state);
+            work(functions[w], axes, values, layout, chunk_size, &ranges[0], nworkers, w);
+            PyThreadState_Clear(state);
+            PyThreadState_DeleteCurrent();
+        }));
+    }
+    for (unsigned int w=0; w<nworkers; w++) threads[w].join();
+    PyEval_RestoreThread(main_state);
+    info = to_string(nworkers) + " sub-interpreters";
+    return true;
+#else
+    (void) profile;
+    (void) axes;
+    (void) values;
+    (void) layout;
+    (void) chunk_size;
+    return false;
+#endif
+}
+
+// Python functions in forked processes, which inherit the interpreter state
+bool ParallelEvaluator::evaluateProcesses(Profile &profile, const vector<vector<double> > &axes, double * values,
+                                          ProfileLayout layout, unsigned int chunk_size)
+{
+    // forking while sub-interpreters exist may deadlock the children
+    endInterpreters();
+    
+    size_t npoints = 1;
+    for (unsigned int i=0; i<axes.size(); i++) npoints *= axes[i].size();
+    
+    // Shared memory: ranges of chunks, then the values
+    size_t header = ((nworkers * sizeof(atomic<uint64_t>) + 63) / 64) * 64;
+    size_t size = header + npoints * sizeof(double);
+    void * shared = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (shared == MAP_FAILED) return false;
+    atomic<uint64_t> * ranges = (atomic<uint64_t> *) shared;
+    for (unsigned int w=0; w<nworkers; w++) new (&ranges[w]) atomic<uint64_t>(0);
+    initRanges(ranges, nworkers, (uint32_t)((npoints-1)/chunk_size+1));
+    double * shared_values = (double *) ((char *) shared + header);
+    
+    // avoid printing the buffered output again in each process
+    cout.flush();
+    fflush(stdout);
+    vector<pid_t> pids;
+    for (unsigned int w=0; w<nworkers; w++) {
+#if PY_VERSION_HEX >= 0x03070000
+        PyOS_BeforeFork();
+#endif
+        pid_t pid = fork();
+        if (pid == 0) {
+#if PY_VERSION_HEX >= 0x03070000
+            PyOS_AfterFork_Child();
+#else
+            PyOS_AfterFork();
+#endif
+            work(profile.function.get(), axes, shared_values, layout, chunk_size, ranges, nworkers, w);
+            cout.flush();
+            fflush(stdout);
+            _exit(0);
+        }
+#if PY_VERSION_HEX >= 0x03070000
+        PyOS_AfterFork_Parent();
+#endif
+        // the other workers steal the chunks of a worker that could not start
+        if (pid < 0) break;
+        pids.push_back(pid);
+    }
+    
+    bool success = !pids.empty();
+    for (unsigned int w=0; w<pids.size(); w++) {
+        int status;
+        if (waitpid(pids[w], &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) success = false;
+    }
+    if (success) {
+        memcpy(values, shared_values, npoints * sizeof(double));
+        info = to_string(pids.size()) + " processes";
+    } else {
+        ERROR("Profile " << profile.name << ": parallel evaluation failed");
+    }
+    munmap(shared, size);
+    return success;
+}
@@ -0,0 +1,55 @@
+#ifndef ParallelEvaluator_H
+#define ParallelEvaluator_H
+
+#include <vector>
+#include <string>
+#include "Profile.h"
+
+//  -------------------------------------------------------------------------------------------
+//! Evaluation of Profile grids split in chunks shared by several workers (work stealing).
+//! Depending on the profile, the workers are:
+//!  - threads, when the function does not call python (native, compiled, ...)
+//!  - threads each running its own sub-interpreter with its own GIL (python >= 3.12),
+//!    in which the namelist is executed again
+//!  - forked processes otherwise, writing in shared memory
+//  -------------------------------------------------------------------------------------------
+class ParallelEvaluator
+{
+public:
+    //! nworkers=0 uses all the cores
+    ParallelEvaluator(unsigned int nworkers=0);
+    //! Ends the sub-interpreters (must be called before PyTools::closePython)
+    ~ParallelEvaluator();
+    
+    //! Same as Profile::valuesAtGrid, the chunks of chunk_size points being shared among the workers
+    void valuesAtGrid(Profile &profile, std::vector<std::vector<double> > axes, double * values,
+                      ProfileLayout layout=layout_rowMajor, unsigned int chunk_size=65536);
+    
+    //! Kind of workers used by the last evaluation
+    inline std::string getInfo() {
+        return info;
+    };
+    
+private:
+    unsigned int nworkers;
+    std::string info;
+    
+    bool evaluateThreads(Profile &profile, const std::vector<std::vector<double> > &axes, double * values,
+                         ProfileLayout layout, unsigned int chunk_size);
+    bool evaluateSubinterpreters(Profile &profile, const std::vector<std::vector<double> > &axes, double * values,
+                                 ProfileLayout layout, unsigned int chunk_size);
+    bool evaluateProcesses(Profile &profile, const std::vector<std::vector<double> > &axes, double * values,
+                           ProfileLayout layout, unsigned int chunk_size);
+    
+    //! Sub-interpreters (thread states) kept between evaluations, with the profiles built in each of them
+    std::vector<PyThreadState*> interpreters;
+    std::vector<std::vector<Profile*> > interpreter_profiles;
+    //! the sub-interpreters failed to start (e.g. the namelist imports a module that does not support them)
+    bool interpreters_failed;
+    
+    //! Profile built in the sub-interpreter i, equivalent to profile
+    Profile * interpreterProfile(unsigned int i, Profile &profile);
+    void endInterpreters();
+};
+
+#endif
@@ -1,53 +1,533 @@
 #include <cmath>
+#include <sstream>
+#include <algorithm>
 
 #include "Profile.h"
+#include "FunctionTabulated.h"
+#include "FunctionChebyshev.h"
+#include "FunctionNative.h"
+#include "FunctionExpression.h"
+#include "ProfileFactorization.h"
+#include "ProfileRegistry.h"
 #include "PyTools.h"
 
 using namespace std;
 
-Profile::Profile(std::string name, std::string component, int nComponent) {
+Profile::Profile(std::string name, std::string component, int nComponent, bool spacetime) :
+    name(name),
+    component(component),
+    nComponent(nComponent),
+    spacetime(spacetime),
+    in_namelist(true),
+    separable(-1),
+    factorization(NULL),
+    function(NULL),
+    nvariables(0)
+{
+    // Without python, the profile is the table recorded in the snapshot
+    if (NamelistSnapshot::replaying()) {
+        vector<vector<double> > axes;
+        unsigned int order;
+        const double * values;
+        if (NamelistSnapshot::getTable(NamelistSnapshot::key(name, component, nComponent), axes, order, values)) {
+            function.reset(new Function_Tabulated(axes, values, order));
+            nvariables = axes.size();
+        } else {
+            ERROR("Profile " << name << " was not tabulated in the namelist snapshot");
+        }
+        return;
+    }
     PyObject *py_profile;
     if (PyTools::extract_pyProfile(name, py_profile, component, nComponent)) {
-        if (!PyCallable_Check(py_profile)) {
-            ERROR("Profile: not a function");
-        }
-        
-        string message;
-        
-        // Verify that the profile has the right number of arguments
-        PyObject* inspect=PyImport_ImportModule("inspect");
-        PyTools::checkPyError();
-        PyObject *tuple = PyObject_CallMethod(inspect,const_cast<char *>("getargspec"),const_cast<char *>("(O)"),py_profile);
-        PyObject *arglist = PyTuple_GetItem(tuple,0);
-        int size = PyObject_Size(arglist);
-        
-        Py_XDECREF(tuple);
-        Py_XDECREF(inspect);
-        
-        // Assign the evaluating function, which depends on the number of arguments
-        if      ( size == 1 ) function = new Function_Python1D(py_profile);
-        else if ( size == 2 ) function = new Function_Python2D(py_profile);
-        else if ( size == 3 ) function = new Function_Python3D(py_profile);
-        else {
-            ERROR("Profile: defined with unsupported number of variables");
+        PyTools::PyRef owner(py_profile);
+        init(py_profile);
+    }
+}
+
+Profile::Profile(PyObject *py_profile, std::string name, bool spacetime) :
+    name(name),
+    nComponent(0),
+    spacetime(spacetime),
+    in_namelist(false),
+    separable(-1),
+    factorization(NULL),
+    function(NULL),
+    nvariables(0)
+{
+    init(py_profile);
+}
+
+void Profile::init(PyObject *py_profile)
+{
+    if (!PyCallable_Check(py_profile)) {
+        ERROR("Profile: not a function");
+    }
+    
+    // The namelist may declare the function separable (or not) with `separable = True`
+    bool declared;
+    if (PyTools::getAttr(py_profile, "separable", declared)) {
+        separable = declared ? 1 : 0;
+        if (declared) factorization = new ProfileFactorization(1e-12, 16, true);
+    }
+    
+    // The same python function may already be evaluated for another profile
+    ProfileRegistry::Entry entry;
+    registry_key = ProfileRegistry::objectKey(py_profile);
+    if (ProfileRegistry::find(registry_key, entry)) {
+        function = entry.function;
+        nvariables = entry.nvariables;
+        fingerprint = entry.fingerprint;
+        registry_key = entry.key;
+        return;
+    }
+    
+    // Key of the grids of this profile in the grid cache
+    PyTools::PyRef py_fingerprint(PyObject_CallMethod(PyImport_AddModule("__main__"), const_cast<char *>("_fingerprint"), const_cast<char *>("(O)"), py_profile));
+    PyTools::checkPyError();
+    if (py_fingerprint && py_fingerprint != Py_None) PyTools::convert(py_fingerprint, fingerprint);
+    
+    // Simple functions are translated to C++ when the namelist sets `compile = True` on them
+    // (see Function_Expression: the numbers they use from the namelist are frozen, and python errors are not raised)
+    bool compile = false;
+    PyTools::getAttr(py_profile, "compile", compile);
+    
+    // or another function with the same code, constants and globals
+    string code_key = ProfileRegistry::fingerprintKey(fingerprint.empty() ? fingerprint : fingerprint + (compile ? " (compiled)" : ""));
+    if (!code_key.empty() && ProfileRegistry::find(code_key, entry)) {
+        ProfileRegistry::add(registry_key, entry, py_profile);
+        function = entry.function;
+        nvariables = entry.nvariables;
+        registry_key = entry.key;
+        return;
+    }
+    
+    function = ProfileRegistry::share(createFunction(py_profile, compile));
+    entry.function = function;
+    entry.nvariables = nvariables;
+    entry.fingerprint = fingerprint;
+    if (!code_key.empty()) {
+        entry.key = code_key;
+        ProfileRegistry::add(code_key, entry);
+    } else {
+        entry.key = registry_key;
+    }
+    ProfileRegistry::add(registry_key, entry, py_profile);
+    registry_key = entry.key;
+}
+
+Function * Profile::createFunction(PyObject *py_profile, bool compile)
+{
+    // Profiles from pyprofiles.py are evaluated in C++
+    if (PyObject_HasAttrString(py_profile, "_native")) {
+        Function * native = Function_Native::create(py_profile, nvariables);
+        if (!native) nvariables = 0;
+        return native;
+    }
+    
+    // Verify that the profile has the right number of arguments
+    int size = PyTools::nArguments(py_profile);
+    
+    if (compile && size >= 1 && size <= 4) {
+        Function * compiled = Function_Expression::create(py_profile, size);
+        if (compiled) {
+            nvariables = size;
+            return compiled;
         }
     }
+    
+    // Assign the evaluating function, which depends on the number of arguments
+    Function * python = NULL;
+    if      ( size == 1 ) python = new Function_Python1D(py_profile);
+    else if ( size == 2 ) python = new Function_Python2D(py_profile);
+    else if ( size == 3 ) python = new Function_Python3D(py_profile);
+    else if ( size == 4 ) python = new Function_Python4D(py_profile);
+    else {
+        ERROR("Profile: defined with unsupported number of variables");
+    }
+    if (python) nvariables = size;
+    return python;
 }
 
 Profile::~Profile()
 {
-    delete function;
+    delete factorization;
+}
+
+void Profile::valuesAtGrid(vector<vector<double> > axes, double * values, ProfileLayout layout, unsigned int chunk_size)
+{
+    INSTRUMENT_CALL("profile " + name);
+    if (axes.size() != nvariables) {
+        ERROR("Profile: grid has " << axes.size() << " axes but the profile has " << nvariables << " variables");
+        return;
+    }
+    if (factorization && factorization->valuesAtGrid(function.get(), axes, values, layout, chunk_size)) return;
+    function->valuesAtGrid(axes, values, layout, chunk_size);
 }
 
+void Profile::valuesAt(const vector<double*> &coordinates, double time, unsigned int npoints, double * values)
+{
+    INSTRUMENT_CALL("profile " + name, npoints);
+    vector<double> times(npoints, time);
+    vector<double*> with_time(coordinates);
+    with_time.push_back(&times[0]);
+    function->valuesAt(with_time, npoints, values);
+}
+
+void Profile::valuesAtGrid(vector<vector<double> > axes, double time, double * values, ProfileLayout layout, unsigned int chunk_size)
+{
+    // the spatial factor of the previous time step may be reused
+    if (factorization && function && axes.size()+1 == nvariables) {
+        INSTRUMENT_CALL("profile " + name);
+        factorization->valuesAtGrid(function.get(), axes, time, values, layout, chunk_size);
+        return;
+    }
+    axes.push_back(vector<double>(1, time));
+    valuesAtGrid(axes, values, layout, chunk_size);
+}
 
-// Functions to evaluate a python function with various numbers of arguments
-// 1D
-double Function_Python1D::valueAt(vector<double> x_cell) {
-    return PyTools::runPyFunction(py_profile, x_cell[0]);
+double Profile::tabulate(vector<double> xmin, vector<double> xmax, vector<unsigned int> npoints,
+                         unsigned int order, double tolerance, unsigned int nsamples)
+{
+    if (nvariables < 1 || nvariables > 3) {
+        ERROR("Profile: tabulation of " << nvariables << " variables not supported (1 to 3)");
+        return -1.;
+    }
+    if (xmin.size() != nvariables || xmax.size() != nvariables || npoints.size() != nvariables) {
+        ERROR("Profile: tabulation domain needs " << nvariables << " dimensions");
+        return -1.;
+    }
+    for (unsigned int i=0; i<nvariables; i++) {
+        if (!(xmax[i] > xmin[i])) {
+            ERROR("Profile: empty tabulation domain along variable " << i);
+            return -1.;
+        }
+    }
+    // the same table may already be made for another profile of the same function
+    ostringstream parameters;
+    parameters << hexfloat << "table " << order << " " << tolerance << " " << nsamples;
+    for (unsigned int i=0; i<nvariables; i++) parameters << " " << xmin[i] << " " << xmax[i] << " " << npoints[i];
+    string key = registry_key.empty() ? registry_key : registry_key + " " + parameters.str();
+    ProfileRegistry::Entry entry;
+    if (Function_Tabulated * table = dynamic_cast<Function_Tabulated *>(findApproximation(key, entry))) {
+        reuseApproximation(key, entry);
+        recordTable(table);
+        return table->getMeasuredError();
+    }
+    
+    Function_Tabulated * table = NULL;
+    double error;
+    while (true) {
+        vector<vector<double> > axes(nvariables);
+        size_t size = 1;
+        for (unsigned int i=0; i<nvariables; i++) {
+            axes[i].resize(max(npoints[i], 2u));
+            for (unsigned int j=0; j<axes[i].size(); j++)
+                axes[i][j] = xmin[i] + (xmax[i]-xmin[i]) * j / (axes[i].size()-1);
+            size *= axes[i].size();
+        }
+        delete table;
+        table = new Function_Tabulated(function.get(), axes, order);
+        error = table->maxError(nsamples);
+        if (error <= tolerance) break;
+        // Refine by halving the intervals, unless the table becomes too large
+        if (size << nvariables > Function_Tabulated::max_size) {
+            ERROR("Profile: tabulation error " << error << " above tolerance " << tolerance << " with the largest allowed table");
+            break;
+        }
+        for (unsigned int i=0; i<nvariables; i++) npoints[i] = 2*max(npoints[i], 2u)-1;
+    }
+    useTable(table, key);
+    return error;
 }
-double Function_Python2D::valueAt(vector<double> x_cell) {
-    return PyTools::runPyFunction(py_profile, x_cell[0], x_cell[1]);
+
+double Profile::tabulate(vector<vector<double> > axes, unsigned int order, double tolerance, unsigned int nsamples)
+{
+    if (nvariables < 1 || nvariables > 3) {
+        ERROR("Profile: tabulation of " << nvariables << " variables not supported (1 to 3)");
+        return -1.;
+    }
+    if (axes.size() != nvariables) {
+        ERROR("Profile: tabulation grid needs " << nvariables << " axes");
+        return -1.;
+    }
+    ostringstream parameters;
+    parameters << hexfloat << "table " << order << " " << tolerance << " " << nsamples;
+    for (unsigned int i=0; i<nvariables; i++) {
+        parameters << " " << axes[i].size() << ":" << PyTools::hashString(string((const char *) axes[i].data(), axes[i].size()*sizeof(double)));
+    }
+    string key = registry_key.empty() ? registry_key : registry_key + " " + parameters.str();
+    ProfileRegistry::Entry entry;
+    if (Function_Tabulated * table = dynamic_cast<Function_Tabulated *>(findApproximation(key, entry))) {
+        reuseApproximation(key, entry);
+        recordTable(table);
+        return table->getMeasuredError();
+    }
+    
+    Function_Tabulated * table = new Function_Tabulated(function.get(), axes, order);
+    if (!table->isValid()) {
+        delete table;
+        return -1.;
+    }
+    double error = table->maxError(nsamples);
+    if (error > tolerance) {
+        ERROR("Profile: tabulation error " << error << " above tolerance " << tolerance);
+    }
+    useTable(table, key);
+    return error;
 }
-double Function_Python3D::valueAt(vector<double> x_cell) {
-    return PyTools::runPyFunction(py_profile, x_cell[0], x_cell[1], x_cell[2]);
+
+double Profile::chebyshev(vector<double> xmin, vector<double> xmax, double tolerance, unsigned int nsamples, size_t max_cost)
+{
+    if (xmin.size() != nvariables || xmax.size() != nvariables || nvariables < 1 || nvariables > 3) {
+        ERROR("Profile: Chebyshev expansion of " << nvariables << " variables needs a box of as many dimensions (1 to 3)");
+        return -1.;
+    }
+    for (unsigned int i=0; i<nvariables; i++) {
+        if (!(xmax[i] > xmin[i])) {
+            ERROR("Profile: empty Chebyshev domain along variable " << i);
+            return -1.;
+        }
+    }
+    // the same expansion may already be made for another profile of the same function
+    ostringstream parameters;
+    parameters << hexfloat << "chebyshev " << tolerance << " " << nsamples;
+    for (unsigned int i=0; i<nvariables; i++) parameters << " " << xmin[i] << " " << xmax[i];
+    string key = registry_key.empty() ? registry_key : registry_key + " " + parameters.str();
+    ProfileRegistry::Entry entry;
+    if (Function_Chebyshev * expansion = dynamic_cast<Function_Chebyshev *>(findApproximation(key, entry))) {
+        if (expansion->getCost() > max_cost) {
+            ERROR("Profile: Chebyshev expansion of " << expansion->getCost() << " multiply-adds per point (above "
+                  << max_cost << "), the profile is not changed");
+            unused_approximations.push_back(entry.function);
+            return -1.;
+        }
+        reuseApproximation(key, entry);
+        return expansion->getMeasuredError();
+    }
+    
+    vector<unsigned int> ncoefficients(nvariables, 16);
+    Function_Chebyshev * expansion = NULL;
+    double error = -1.;
+    while (true) {
+        delete expansion;
+        expansion = new Function_Chebyshev(function.get(), xmin, xmax, ncoefficients);
+        vector<bool> resolved = expansion->resolved(tolerance);
+        bool all_resolved = find(resolved.begin(), resolved.end(), false) == resolved.end();
+        if (all_resolved) {
+            expansion->truncate(tolerance);
+            error = expansion->maxError(nsamples);
+            if (error <= tolerance) break;
+            // resolved on the Chebyshev points only: raise all the degrees
+            resolved.assign(nvariables, false);
+        }
+        // Double the degree along the unresolved variables, unless the expansion becomes too large
+        size_t size = 1;
+        for (unsigned int i=0; i<nvariables; i++) {
+            if (!resolved[i]) ncoefficients[i] *= 2;
+            size *= ncoefficients[i];
+        }
+        if (size > Function_Chebyshev::max_size
+            || *max_element(ncoefficients.begin(), ncoefficients.end()) > Function_Chebyshev::max_ncoefficients) {
+            if (!all_resolved) error = expansion->maxError(nsamples);
+            ERROR("Profile: Chebyshev expansion error " << error << " above tolerance " << tolerance << " with the largest allowed degree");
+            break;
+        }
+    }
+    expansion->shareExact(function);
+    string suffix = "-chebyshev-" + to_string(PyTools::hashString(parameters.str()));
+    // of no use if a point costs more than a call of the function it replaces
+    // (kept for the other profiles of the function, which may accept a larger cost, without sampling again)
+    if (expansion->getCost() > max_cost) {
+        ERROR("Profile: Chebyshev expansion of " << expansion->getCost() << " multiply-adds per point (above "
+              << max_cost << "), the profile is not changed");
+        keepApproximation(expansion, key, suffix);
+        return -1.;
+    }
+    useApproximation(expansion, key, suffix);
+    return error;
+}
+
+void Profile::factorize(double tolerance, unsigned int nsamples)
+{
+    if (separable == 0) return;
+    delete factorization;
+    factorization = new ProfileFactorization(tolerance, nsamples, separable == 1);
+}
+
+void Profile::useTable(Function_Tabulated * table, const string &key)
+{
+    table->shareExact(function);
+    // the values now also depend on the nodes and order of the table
+    ostringstream nodes;
+    nodes << table->getOrder();
+    for (unsigned int i=0; i<table->getAxes().size(); i++) {
+        nodes << ";";
+        for (unsigned int j=0; j<table->getAxes()[i].size(); j++) nodes << " " << hexfloat << table->getAxes()[i][j];
+    }
+    useApproximation(table, key, "-table-" + to_string(PyTools::hashString(nodes.str())));
+    recordTable(table);
+}
+
+void Profile::useApproximation(Function * approximation, const string &key, const string &suffix)
+{
+    function = ProfileRegistry::share(approximation);
+    if (!fingerprint.empty()) fingerprint += suffix;
+    if (!key.empty()) {
+        ProfileRegistry::Entry entry;
+        entry.function = function;
+        entry.nvariables = nvariables;
+        entry.fingerprint = fingerprint;
+        entry.key = key;
+        ProfileRegistry::add(key, entry);
+        registry_key = key;
+    }
+}
+
+void Profile::keepApproximation(Function * approximation, const string &key, const string &suffix)
+{
+    if (key.empty()) {
+        delete approximation;
+        return;
+    }
+    ProfileRegistry::Entry entry;
+    entry.function = ProfileRegistry::share(approximation);
+    entry.nvariables = nvariables;
+    entry.fingerprint = fingerprint.empty() ? fingerprint : fingerprint + suffix;
+    entry.key = key;
+    ProfileRegistry::add(key, entry);
+    unused_approximations.push_back(entry.function);
+}
+
+Function * Profile::findApproximation(const string &key, ProfileRegistry::Entry &entry)
+{
+    if (key.empty() || !ProfileRegistry::find(key, entry)) return NULL;
+    return entry.function.get();
+}
+
+void Profile::reuseApproximation(const string &key, const ProfileRegistry::Entry &entry)
+{
+    function = entry.function;
+    fingerprint = entry.fingerprint;
+    registry_key = key;
+}
+
+void Profile::recordTable(Function_Tabulated * table)
+{
+    // the table can replace the profile when the namelist is replayed
+    if (NamelistSnapshot::recording() && in_namelist) {
+        NamelistSnapshot::putTable(NamelistSnapshot::key(name, component, nComponent), table->getAxes(), table->getOrder(), table->getValues());
+    }
+}
+
+string Profile::getInfo()
+{
+    string info = name + " (" + to_string(nvariables) + " variables" + (spacetime ? ", the last one being time" : "") + "): ";
+    info += function ? function->getInfo() : "undefined";
+    if (factorization) info += " (" + factorization->getInfo() + ")";
+    return info;
+}
+
+
+// Evaluate a function on a rectilinear grid, one block of points at a time
+void Function::valuesAtGrid(vector<vector<double> > axes, double * values, ProfileLayout layout, unsigned int chunk_size,
+                            size_t first, size_t count)
+{
+    unsigned int ndim = axes.size();
+    size_t npoints = 1;
+    for (unsigned int i=0; i<ndim; i++) npoints *= axes[i].size();
+    if (first >= npoints) return;
+    npoints = min(npoints, first + min(count, npoints-first));
+    if (chunk_size == 0) chunk_size = 1;
+    
+    // Order of the axes from the fastest to the slowest varying
+    vector<unsigned int> order(ndim);
+    for (unsigned int i=0; i<ndim; i++) order[i] = (layout==layout_rowMajor) ? ndim-1-i : i;
+    
+    vector<vector<double> > buffer(ndim, vector<double>(min((size_t)chunk_size, npoints-first)));
+    vector<double*> coordinates(ndim);
+    for (unsigned int i=0; i<ndim; i++) coordinates[i] = &buffer[i][0];
+    
+    // Multi-index of the first point
+    vector<size_t> index(ndim, 0);
+    size_t rest = first;
+    for (unsigned int k=0; k<ndim; k++) {
+        unsigned int i = order[k];
+        index[i] = rest % axes[i].size();
+        rest /= axes[i].size();
+    }
+    
+    for (size_t start=first; start<npoints; start+=chunk_size) {
+        unsigned int n = (unsigned int) min((size_t)chunk_size, npoints-start);
+        // Fill the coordinates of this block, incrementing the multi-index like an odometer
+        for (unsigned int p=0; p<n; p++) {
+            for (unsigned int i=0; i<ndim; i++) buffer[i][p] = axes[i][index[i]];
+            for (unsigned int k=0; k<ndim; k++) {
+                unsigned int i = order[k];
+                if (++index[i] < axes[i].size()) break;
+                index[i] = 0;
+            }
+        }
+        valuesAt(coordinates, n, values+start);
+    }
+}
+
+
+// Default batched evaluation: one call per point
+void Function::valuesAt(const vector<double*> &coordinates, unsigned int npoints, double * values)
+{
+    double x[Profile::max_variables];
+    unsigned int ndim = coordinates.size();
+    for (unsigned int p=0; p<npoints; p++) {
+        for (unsigned int i=0; i<ndim; i++) x[i] = coordinates[i][p];
+        values[p] = valueAt(x);
+    }
+}
+
+// Batched evaluation of a python function: one python call for all points if possible
+void Function_Python::valuesAt(const vector<double*> &coordinates, unsigned int npoints, double * values)
+{
+    if (npoints == 0) return;
+    INSTRUMENT_CALL(label, npoints);
+    PyTools::GILState gil;
+    if (vectorized != 0) {
+        if (PyTools::runPyFunction(py_profile, coordinates, npoints, values)) {
+            if (vectorized < 0) {
+                // First batch: make sure that the array call gives the same result as the scalar call
+                double x[Profile::max_variables];
+                for (unsigned int i=0; i<nvariables; i++) x[i] = coordinates[i][0];
+                double v = call(x);
+                call.checkErrors();
+                vectorized = (v == values[0] || abs(v-values[0]) <= 1e-12*abs(v)) ? 1 : 0;
+            }
+            if (vectorized == 1) return;
+        } else {
+            vectorized = 0;
+        }
+    }
+    // The function does not accept arrays: one call per point
+    double x[Profile::max_variables];
+    for (unsigned int p=0; p<npoints; p++) {
+        for (unsigned int i=0; i<nvariables; i++) x[i] = coordinates[i][p];
+        values[p] = call(x);
+    }
+    call.checkErrors();
+}
+
+// Evaluate the python function at one point
+// (the GIL is taken so that profiles can be evaluated from any thread; waiting for it is part of the call time)
+double Function_Python::valueAt(const double * x)
+{
+    INSTRUMENT_CALL(label);
+    PyTools::GILState gil;
+    double value = call(x);
+    call.checkErrors();
+    return value;
+}
+
+string Function_Python::getInfo()
+{
+    string info = "python function";
+    if (vectorized == 1) info += " (vectorized)";
+    if (vectorized == 0) info += " (not vectorized)";
+    return info;
 }
@@ -2,8 +2,23 @@
 #define Profile_H
 
 #include <vector>
+#include <array>
 #include <string>
+#include <memory>
 #include "PyTools.h"
+#include "ProfileRegistry.h"
+
+class Function_Tabulated;
+class Function_Chebyshev;
+class ProfileFactorization;
+
+//! Memory layout of the values filled by Profile::valuesAtGrid
+enum ProfileLayout {
+    //! last coordinate varies fastest (C order)
+    layout_rowMajor,
+    //! first coordinate varies fastest (Fortran order)
+    layout_columnMajor
+};
 
 class Function
 {
@@ -12,10 +27,27 @@ public:
     Function(){};
     //! Default destructor
     virtual ~Function(){};
-    // spatial
-    virtual double valueAt(std::vector<double>) {
+    //! value at one point, coordinates[i] being its coordinate i (no allocation nor copy)
+    virtual double valueAt(const double *) {
         return 0.;
     };
+    inline double valueAt(const std::vector<double> &coordinates) {
+        return valueAt(&coordinates[0]);
+    };
+    //! batched evaluation: coordinates[i][p] is the coordinate i of point p, fills values[p]
+    virtual void valuesAt(const std::vector<double*> &coordinates, unsigned int npoints, double * values);
+    //! description of how the function is evaluated
+    virtual std::string getInfo() {
+        return "";
+    };
+    //! whether the evaluation calls the python interpreter
+    virtual bool usesPython() {
+        return true;
+    };
+    //! evaluation on the rectilinear grid axes[0] x axes[1] x ..., by blocks of at most chunk_size points
+    //! (only the count points starting at the index first in the layout are evaluated)
+    void valuesAtGrid(std::vector<std::vector<double> > axes, double * values, ProfileLayout layout, unsigned int chunk_size,
+                      size_t first=0, size_t count=(size_t)-1);
 };
 
 
@@ -26,18 +58,165 @@ class Profile
 {
 public:
     //! Default constructor
-    Profile(std::string name, std::string component=std::string(""), int nComponent=0);
+    //! With spacetime, the last argument of the function is the time.
+    //! When replaying a namelist snapshot, the profile is the table recorded by tabulate.
+    Profile(std::string name, std::string component=std::string(""), int nComponent=0, bool spacetime=false);
+    //! Profile from a python function (e.g. from PyTools::extract2Profiles)
+    Profile(PyObject *py_profile, std::string name, bool spacetime=false);
     //! Default destructor
     ~Profile();
     
     //! Get the value of the profile at some location (spatial)
-    inline double valueAt(std::vector<double> coordinates) {
+    inline double valueAt(const std::vector<double> &coordinates) {
+        INSTRUMENT_CALL("profile " + name);
+        return function->valueAt(&coordinates[0]);
+    };
+    
+    //! Same with the coordinates in an array (nvariables values), e.g. valueAt(std::array<double,3>{x, y, z})
+    template <size_t N>
+    inline double valueAt(const std::array<double, N> &coordinates) {
+        INSTRUMENT_CALL("profile " + name);
+        return function->valueAt(coordinates.data());
+    };
+    inline double valueAt(const double * coordinates) {
+        INSTRUMENT_CALL("profile " + name);
         return function->valueAt(coordinates);
     };
     
+    //! Get the values of the profile at a list of points (coordinates[i][p] is the coordinate i of point p)
+    inline void valuesAt(const std::vector<double*> &coordinates, unsigned int npoints, double * values) {
+        INSTRUMENT_CALL("profile " + name, npoints);
+        function->valuesAt(coordinates, npoints, values);
+    };
+    
+    //! Fill values with the profile on the rectilinear grid axes[0] x axes[1] x ...
+    //! The grid is evaluated by blocks of at most chunk_size points
+    void valuesAtGrid(std::vector<std::vector<double> > axes, double * values, ProfileLayout layout=layout_rowMajor, unsigned int chunk_size=65536);
+    
+    //! Get the value of a space-time profile at some location and time
+    inline double valueAt(const std::vector<double> &coordinates, double time) {
+        INSTRUMENT_CALL("profile " + name);
+        double x[max_variables];
+        for (unsigned int i=0; i<coordinates.size(); i++) x[i] = coordinates[i];
+        x[coordinates.size()] = time;
+        return function->valueAt(x);
+    };
+    
+    //! Same as valuesAt and valuesAtGrid for a space-time profile at a given time
+    void valuesAt(const std::vector<double*> &coordinates, double time, unsigned int npoints, double * values);
+    void valuesAtGrid(std::vector<std::vector<double> > axes, double time, double * values, ProfileLayout layout=layout_rowMajor, unsigned int chunk_size=65536);
+    
+    //! Replace the evaluation by an interpolation (order 1: linear, 3: cubic) in a table
+    //! sampled once on npoints uniform nodes between xmin and xmax along each variable.
+    //! The table is refined until the error measured on nsamples random points is below
+    //! tolerance (relative to the largest sampled value). Returns the measured error.
+    double tabulate(std::vector<double> xmin, std::vector<double> xmax, std::vector<unsigned int> npoints,
+                    unsigned int order=1, double tolerance=0., unsigned int nsamples=1000);
+    
+    //! Same as above with user-specified nodes along each variable (no refinement)
+    double tabulate(std::vector<std::vector<double> > axes, unsigned int order=1, double tolerance=0., unsigned int nsamples=1000);
+    
+    //! Replace the evaluation, for smooth profiles of 1 to 3 variables, by a Chebyshev expansion on the box
+    //! [xmin[0], xmax[0]] x [xmin[1], xmax[1]] x ... (see Function_Chebyshev). The degree along each variable
+    //! is doubled until the last coefficients and the error measured on nsamples random points are below
+    //! tolerance (relative to the largest sampled value), then the negligible coefficients are dropped.
+    //! A point then costs one multiply-add per kept coefficient plus the polynomials along each variable
+    //! (Function_Chebyshev::getCost, tens in 1D, hundreds in 2D, thousands in 3D at 1e-10): the expansion
+    //! is refused (-1, the profile is unchanged) when it costs more than max_cost multiply-adds per point.
+    //! The default is about the time of one call of a python function (a few hundred ns, -O2);
+    //! functions evaluated faster, e.g. vectorized with numpy (about 10 ns per point), need a lower max_cost.
+    //! A refused expansion stays registered: the other profiles of the function do not sample it again.
+    //! Returns the measured error. Unlike tables, expansions are not recorded in namelist snapshots.
+    double chebyshev(std::vector<double> xmin, std::vector<double> xmax, double tolerance=1e-10, unsigned int nsamples=1000,
+                     size_t max_cost=chebyshev_max_cost);
+    
+    //! Evaluate the grids as products of factors along the variables in which the profile is separable
+    //! (see ProfileFactorization), probed on nsamples points of each grid with the given relative tolerance.
+    //! Without effect when the namelist sets `separable = False` on the function.
+    void factorize(double tolerance=1e-12, unsigned int nsamples=16);
+    
+    //! Number of variables of the profile function (including the time)
+    inline unsigned int getNvariables() {
+        return nvariables;
+    };
+    
+    //! Whether the last variable is the time
+    inline bool isSpaceTime() {
+        return spacetime;
+    };
+    
+    //! Function evaluating the profile, as its actual type T if it is one (NULL otherwise).
+    //! Calls through a final class (e.g. Function_Gaussian) are not virtual and can be inlined in loops.
+    template <class T>
+    inline T * getFunction() {
+        return dynamic_cast<T *>(function.get());
+    };
+    
+    //! Largest number of variables of a profile
+    static const unsigned int max_variables = 4;
+    
+    //! Default largest cost of a Chebyshev expansion (multiply-adds per point)
+    static const size_t chebyshev_max_cost = 256;
+    
+    //! Description of the profile and of how it is evaluated
+    std::string getInfo();
+    
+    //! Hash of the function and of everything its values depend on (see _fingerprint in pyprofiles.py),
+    //! empty when it is unknown (e.g. the function uses objects that cannot be described)
+    inline std::string getFingerprint() {
+        return fingerprint;
+    };
+    
 private:
-    //! Object that holds the information on the profile function
-    Function * function;
+    //! Name of the profile in the namelist, and component block it belongs to
+    std::string name, component;
+    int nComponent;
+    
+    //! Whether the last variable is the time
+    bool spacetime;
+    
+    //! Whether the profile can be found again in the namelist from its name and component
+    bool in_namelist;
+    
+    //! Attribute `separable` of the python function (-1 when absent)
+    int separable;
+    
+    //! Evaluation of the grids by factors (NULL unless the profile is separable or factorize was called)
+    ProfileFactorization * factorization;
+    
+    std::string fingerprint;
+    
+    //! Key of the function in the ProfileRegistry (empty when it is not registered)
+    std::string registry_key;
+    
+    //! Build the evaluating function, or share the one of a profile of the same python function
+    void init(PyObject *py_profile);
+    Function * createFunction(PyObject *py_profile, bool compile);
+    
+    //! Evaluate the profile with a table from now on (shared with the other profiles under key)
+    void useTable(Function_Tabulated *table, const std::string &key);
+    void recordTable(Function_Tabulated *table);
+    //! Evaluate the profile with an approximation of its function from now on (shared with the other
+    //! profiles under key), the fingerprint being extended by suffix
+    void useApproximation(Function *approximation, const std::string &key, const std::string &suffix);
+    //! Register an approximation under key without using it (kept in unused_approximations)
+    void keepApproximation(Function *approximation, const std::string &key, const std::string &suffix);
+    //! Approximation registered under key by a profile of the same function, if any (NULL otherwise)
+    Function * findApproximation(const std::string &key, ProfileRegistry::Entry &entry);
+    //! Evaluate the profile with the approximation found in entry from now on
+    void reuseApproximation(const std::string &key, const ProfileRegistry::Entry &entry);
+    
+    //! Approximations made (or found) but not used, e.g. Chebyshev expansions too costly for this profile,
+    //! kept alive so that the other profiles of the function find them in the registry
+    std::vector<std::shared_ptr<Function> > unused_approximations;
+
+    //! Object that holds the information on the profile function (shared, see ProfileRegistry)
+    std::shared_ptr<Function> function;
+    
+    //! Number of variables of the profile function
+    unsigned int nvariables;
+    
+    friend class ParallelEvaluator;
     
 };//END class Profile
 
@@ -45,33 +224,58 @@ private:
 
 // Children classes for python functions
 
-class Function_Python1D : public Function
+class Function_Python : public Function
 {
 public:
-    Function_Python1D(PyObject *pp) : py_profile(pp) {};
-    double valueAt(std::vector<double>); // space
+    Function_Python(PyObject *pp, unsigned int nv) : py_profile(PyTools::PyRef::borrow(pp)), label("python"), call(pp, nv), nvariables(nv), vectorized(-1) {
+        std::string py_name;
+        if (PyTools::getAttr(pp, "__name__", py_name)) label += " " + py_name;
+    };
+    //! one python call (the GIL is taken so that profiles can be evaluated from any thread)
+    double valueAt(const double *);
+    //! hands whole blocks of points to python when the function accepts numpy arrays
+    void valuesAt(const std::vector<double*> &, unsigned int, double *);
+    std::string getInfo();
+protected:
+    //! the python function is kept alive by the profile
+    PyTools::PyRef py_profile;
+    //! name of the python function, for the instrumentation
+    std::string label;
+    //! calls with reused arguments
+    PyTools::FastCall call;
 private:
-    PyObject *py_profile;
+    //! Number of arguments of the python function
+    unsigned int nvariables;
+    //! Whether the function accepts numpy arrays (-1 until the first batched call)
+    int vectorized;
 };
 
 
-class Function_Python2D : public Function
+class Function_Python1D final : public Function_Python
 {
 public:
-    Function_Python2D(PyObject *pp) : py_profile(pp) {};
-    double valueAt(std::vector<double>); // space
-private:
-    PyObject *py_profile;
+    Function_Python1D(PyObject *pp) : Function_Python(pp, 1) {};
 };
 
 
-class Function_Python3D : public Function
+class Function_Python2D final : public Function_Python
 {
 public:
-    Function_Python3D(PyObject *pp) : py_profile(pp) {};
-    double valueAt(std::vector<double>); // space
-private:
-    PyObject *py_profile;
+    Function_Python2D(PyObject *pp) : Function_Python(pp, 2) {};
+};
+
+
+class Function_Python3D final : public Function_Python
+{
+public:
+    Function_Python3D(PyObject *pp) : Function_Python(pp, 3) {};
+};
+
+
+class Function_Python4D final : public Function_Python
+{
+public:
+    Function_Python4D(PyObject *pp) : Function_Python(pp, 4) {};
 };
 
 
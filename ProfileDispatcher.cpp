@@ -0,0 +1,169 @@
+#include <algorithm>
+#include <sstream>
+
+#include "ProfileDispatcher.h"
+
+using namespace std;
+
+ProfileDispatcher::ProfileDispatcher(Profile &profile, unsigned int max_batch) :
+    profile(profile),
+    nvariables(profile.getNvariables()),
+    max_batch(max(1u, max_batch)),
+    pending(NULL),
+    idle(false),
+    stop(false),
+    nrequests(0),
+    npoints(0),
+    nbatches(0),
+    batch_coordinates(profile.getNvariables())
+{
+    gil = new PyTools::GILRelease();
+    dispatcher = thread(&ProfileDispatcher::run, this);
+}
+
+ProfileDispatcher::~ProfileDispatcher()
+{
+    {
+        lock_guard<mutex> lock(idle_mutex);
+        stop = true;
+    }
+    condition.notify_one();
+    dispatcher.join();
+    delete gil;
+}
+
+future<double> ProfileDispatcher::submit(const double * coordinates)
+{
+    PointRequest * request = new PointRequest();
+    for (unsigned int i=0; i<nvariables; i++) request->point[i] = coordinates[i];
+    future<double> result = request->promise.get_future();
+    push(request);
+    return result;
+}
+
+future<void> ProfileDispatcher::submit(const vector<double*> &coordinates, unsigned int npoints, double * values)
+{
+    BatchRequest * request = new BatchRequest();
+    future<void> result = request->promise.get_future();
+    if (init(request, coordinates, npoints, values)) push(request);
+    return result;
+}
+
+void ProfileDispatcher::submit(const vector<double*> &coordinates, unsigned int npoints, double * values, function<void(bool)> done)
+{
+    CallbackRequest * request = new CallbackRequest();
+    request->callback = done;
+    if (init(request, coordinates, npoints, values)) push(request);
+}
+
+bool ProfileDispatcher::init(Request * request, const vector<double*> &coordinates, unsigned int npoints, double * values)
+{
+    if (coordinates.size() != nvariables) {
+        ostringstream message;
+        message << "ProfileDispatcher: " << coordinates.size() << " coordinate arrays for " << nvariables << " variables";
+        ERROR(message.str());
+        // failed at once, the values are left unchanged
+        request->fail(message.str());
+        delete request;
+        return false;
+    }
+    request->npoints = npoints;
+    request->coordinates = coordinates;
+    request->values = values;
+    return true;
+}
+
+// Lock-free push on the pending list. The dispatcher takes the whole list before it waits, so it only
+// needs to be woken up by the request that makes the list non-empty, and only when it waits
+// (it sets idle before checking the list again, so that one of the two sees the other).
+// Once published, the request may already be completed and deleted: only the old head is used after
+void ProfileDispatcher::push(Request * request)
+{
+    Request * head = pending.load();
+    do {
+        request->next = head;
+    } while (!pending.compare_exchange_weak(head, request));
+    if (!head && idle.load()) {
+        lock_guard<mutex> lock(idle_mutex);
+        condition.notify_one();
+    }
+}
+
+void ProfileDispatcher::run()
+{
+    vector<Request*> requests;
+    while (true) {
+        // all the pending requests at once
+        Request * list = pending.exchange(NULL);
+        if (!list) {
+            if (stop) return;
+            unique_lock<mutex> lock(idle_mutex);
+            idle = true;
+            condition.wait(lock, [&]() { return stop || pending.load() != NULL; });
+            idle = false;
+            continue;
+        }
+        requests.clear();
+        for (Request * r=list; r; r=r->next) requests.push_back(r);
+        reverse(requests.begin(), requests.end());
+        process(requests);
+    }
+}
+
+void ProfileDispatcher::process(vector<Request*> &requests)
+{
+    // the GIL is held for all the batches (the calls of the profile take it again at no cost)
+    PyTools::GILState * gil_state = Py_IsInitialized() ? new PyTools::GILState() : NULL;
+    vector<double*> coordinates(nvariables);
+    size_t r = 0;
+    while (r < requests.size()) {
+        // large batches directly from the arrays of the caller
+        if (requests[r]->npoints > max_batch) {
+            profile.valuesAt(requests[r]->coordinates, requests[r]->npoints, requests[r]->values);
+            nbatches++;
+            complete(requests[r++]);
+            continue;
+        }
+        // the next requests that fit in one batch, copied together
+        size_t first = r;
+        unsigned int n = 0;
+        while (r < requests.size() && n + requests[r]->npoints <= max_batch) n += requests[r++]->npoints;
+        for (unsigned int i=0; i<nvariables; i++) {
+            batch_coordinates[i].resize(n);
+            coordinates[i] = batch_coordinates[i].data();
+        }
+        batch_values.resize(n);
+        for (size_t k=first, p=0; k<r; k++) {
+            Request * request = requests[k];
+            for (unsigned int i=0; i<nvariables; i++) {
+                if (request->single) batch_coordinates[i][p] = ((PointRequest *) request)->point[i];
+                else copy(request->coordinates[i], request->coordinates[i] + request->npoints, batch_coordinates[i].data() + p);
+            }
+            p += request->npoints;
+        }
+        if (n > 0) profile.valuesAt(coordinates, n, batch_values.data());
+        nbatches++;
+        for (size_t k=first, p=0; k<r; k++) {
+            Request * request = requests[k];
+            if (request->single) ((PointRequest *) request)->value = batch_values[p];
+            else copy(batch_values.data() + p, batch_values.data() + p + request->npoints, request->values);
+            p += request->npoints;
+            complete(request);
+        }
+    }
+    delete gil_state;
+}
+
+void ProfileDispatcher::complete(Request * request)
+{
+    nrequests++;
+    npoints += request->npoints;
+    request->complete();
+    delete request;
+}
+
+string ProfileDispatcher::getInfo()
+{
+    size_t b = nbatches;
+    return to_string(nrequests) + " requests of " + to_string(npoints) + " points in " + to_string(b) + " batch" + (b > 1 ? "es" : "");
+}
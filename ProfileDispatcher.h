@@ -0,0 +1,135 @@
+#ifndef ProfileDispatcher_H
+#define ProfileDispatcher_H
+
+#include <vector>
+#include <string>
+#include <atomic>
+#include <future>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <stdexcept>
+#include "Profile.h"
+
+//  -------------------------------------------------------------------------------------------
+//! Evaluation of a profile requested from any number of threads (e.g. OpenMP loops of the host code).
+//! The requests (single points or small batches) are pushed on a lock-free list; a dispatcher thread
+//! takes all the pending requests at once, holds the GIL and evaluates them together with
+//! Profile::valuesAt in batches of at most max_batch points, then completes their futures or calls
+//! their callbacks. Many small concurrent calls become a few large ones, and the profile is only
+//! used by the dispatcher thread (python functions are not reentrant).
+//! While it exists, the GIL of the creating thread is released: python must be called
+//! from this thread within a PyTools::GILState (Profile does it).
+//  -------------------------------------------------------------------------------------------
+class ProfileDispatcher
+{
+public:
+    ProfileDispatcher(Profile &profile, unsigned int max_batch=65536);
+    //! Evaluates the pending requests, then stops the dispatcher
+    ~ProfileDispatcher();
+    
+    //! Value at one point (the nvariables coordinates are copied)
+    std::future<double> submit(const double * coordinates);
+    
+    //! Values at npoints points (coordinates[i][p] is the coordinate i of point p) written in values;
+    //! the arrays must stay valid until the future is ready. When the number of coordinate arrays
+    //! does not match the profile, the future holds a std::invalid_argument (values unchanged)
+    std::future<void> submit(const std::vector<double*> &coordinates, unsigned int npoints, double * values);
+    
+    //! Same, done(true) being called by the dispatcher thread once the values are written
+    //! (done(false) at once by the calling thread, without evaluation, when the arrays do not match the profile)
+    void submit(const std::vector<double*> &coordinates, unsigned int npoints, double * values, std::function<void(bool)> done);
+    
+    //! Value at one point, waiting for it
+    inline double valueAt(const double * coordinates) {
+        return submit(coordinates).get();
+    };
+    
+    //! Number of requests, points and batches evaluated so far
+    std::string getInfo();
+    
+private:
+    //! A request, in the list of pending requests
+    struct Request {
+        Request() : next(NULL), single(false), npoints(0), values(NULL) {};
+        virtual ~Request() {};
+        Request * next;
+        //! single point (a PointRequest), otherwise arrays of the caller
+        bool single;
+        unsigned int npoints;
+        std::vector<double*> coordinates;
+        double * values;
+        //! called once the values are written
+        virtual void complete() = 0;
+        //! called instead when the request cannot be evaluated
+        virtual void fail(const std::string &message) = 0;
+    };
+    //! single point: coordinates and value kept in the request
+    struct PointRequest : Request {
+        PointRequest() {
+            single = true;
+            npoints = 1;
+        };
+        double point[Profile::max_variables];
+        double value;
+        std::promise<double> promise;
+        void complete() {
+            promise.set_value(value);
+        };
+        void fail(const std::string &message) {
+            promise.set_exception(std::make_exception_ptr(std::invalid_argument(message)));
+        };
+    };
+    struct BatchRequest : Request {
+        std::promise<void> promise;
+        void complete() {
+            promise.set_value();
+        };
+        void fail(const std::string &message) {
+            promise.set_exception(std::make_exception_ptr(std::invalid_argument(message)));
+        };
+    };
+    struct CallbackRequest : Request {
+        std::function<void(bool)> callback;
+        void complete() {
+            callback(true);
+        };
+        void fail(const std::string &) {
+            callback(false);
+        };
+    };
+    
+    Profile &profile;
+    unsigned int nvariables, max_batch;
+    
+    //! pending requests, the last pushed first
+    std::atomic<Request*> pending;
+    //! the dispatcher waits for requests (producers then wake it up)
+    std::atomic<bool> idle;
+    std::atomic<bool> stop;
+    std::mutex idle_mutex;
+    std::condition_variable condition;
+    
+    std::atomic<size_t> nrequests, npoints, nbatches;
+    
+    //! coordinates and values of the points of a batch
+    std::vector<std::vector<double> > batch_coordinates;
+    std::vector<double> batch_values;
+    
+    std::thread dispatcher;
+    //! GIL of the creating thread, released during the lifetime of the object
+    PyTools::GILRelease * gil;
+    
+    void push(Request * request);
+    //! loop of the dispatcher thread
+    void run();
+    //! evaluates the requests (in the order of submission) and completes them
+    void process(std::vector<Request*> &requests);
+    void complete(Request * request);
+    //! a batch request for the arrays of the caller, or false when they do not match the profile
+    //! (the request then fails and is deleted, without evaluation)
+    bool init(Request * request, const std::vector<double*> &coordinates, unsigned int npoints, double * values);
+};
+
+#endif
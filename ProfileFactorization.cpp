@@ -0,0 +1,263 @@
+#include <cmath>
+#include <random>
+#include <sstream>
+
+#include "ProfileFactorization.h"
+
+using namespace std;
+
+ProfileFactorization::ProfileFactorization(double t, unsigned int n, bool a) :
+    tolerance(t),
+    nsamples(n),
+    assumed(a),
+    time_reused(false),
+    cached_function(NULL),
+    cached_layout(layout_rowMajor),
+    cached_neighbours(0)
+{
+}
+
+bool ProfileFactorization::valuesAtGrid(Function *function, const vector<vector<double> > &axes, double * values,
+                                        ProfileLayout layout, unsigned int chunk_size)
+{
+    separated.clear();
+    unsigned int ndim = axes.size();
+    size_t npoints = 1;
+    vector<unsigned int> candidates;
+    for (unsigned int i=0; i<ndim; i++) {
+        npoints *= axes[i].size();
+        if (axes[i].size() > 1) candidates.push_back(i);
+    }
+    // nothing to gain with a single variable, nor when the probe costs about as much as the grid
+    size_t cost = (size_t)nsamples * (assumed ? 1 : 1 + 2*candidates.size());
+    if (candidates.size() < 2 || nsamples == 0 || npoints <= 2*cost) return false;
+
+    // Random points of the grid (fixed seed so that the decision is reproducible)
+    mt19937 rng(12345);
+    vector<vector<size_t> > samples(ndim, vector<size_t>(nsamples));
+    for (unsigned int i=0; i<ndim; i++) {
+        uniform_int_distribution<size_t> dist(0, axes[i].size()-1);
+        for (unsigned int p=0; p<nsamples; p++) samples[i][p] = dist(rng);
+    }
+    vector<double> f(nsamples);
+    valuesAtIndices(function, axes, samples, &f[0]);
+    // the reference point is the largest value
+    unsigned int ref = 0;
+    for (unsigned int p=1; p<nsamples; p++) {
+        if (abs(f[p]) > abs(f[ref])) ref = p;
+    }
+    double f0 = f[ref];
+    if (f0 == 0. || !isfinite(f0)) return false;
+    // where f is negligible both sides of the test are about 0 whatever f is: the test is only meaningful
+    // at samples where |f| >= sqrt(tolerance) |f0| (relative error on f below sqrt(tolerance)), and a function
+    // localized on a small part of the grid (few such samples) is evaluated as a whole
+    if (!assumed) {
+        unsigned int significant = 0;
+        for (unsigned int p=0; p<nsamples; p++) {
+            if (abs(f[p]) >= sqrt(tolerance)*abs(f0)) significant++;
+        }
+        if (significant < 2 || 4*significant < nsamples) return false;
+    }
+    vector<size_t> x0(ndim);
+    for (unsigned int i=0; i<ndim; i++) x0[i] = samples[i][ref];
+
+    // Probe each variable: f(x) f(x0) = f(x_i, x0_others) f(x0_i, x_others)
+    vector<unsigned int> sep;
+    if (assumed) {
+        sep = candidates;
+    } else {
+        vector<vector<size_t> > probe(ndim, vector<size_t>(2*nsamples));
+        vector<double> g(2*nsamples);
+        for (unsigned int c : candidates) {
+            for (unsigned int i=0; i<ndim; i++) {
+                for (unsigned int p=0; p<nsamples; p++) {
+                    probe[i][p]          = (i==c) ? samples[i][p] : x0[i];
+                    probe[i][nsamples+p] = (i==c) ? x0[i] : samples[i][p];
+                }
+            }
+            valuesAtIndices(function, axes, probe, &g[0]);
+            bool separable = true;
+            for (unsigned int p=0; p<nsamples && separable; p++) {
+                separable = abs(f[p]*f0 - g[p]*g[nsamples+p]) <= tolerance*f0*f0;
+            }
+            if (separable) sep.push_back(c);
+        }
+    }
+    if (sep.empty()) return false;
+
+    // Factors along the separated variables, the others being at x0 (normalized by f0)
+    vector<vector<double> > factors(ndim);
+    for (unsigned int c : sep) {
+        size_t n = axes[c].size();
+        vector<vector<size_t> > indices(ndim, vector<size_t>(n));
+        for (unsigned int i=0; i<ndim; i++) {
+            for (size_t j=0; j<n; j++) indices[i][j] = (i==c) ? j : x0[i];
+        }
+        factors[c].resize(n);
+        valuesAtIndices(function, axes, indices, &factors[c][0]);
+        for (size_t j=0; j<n; j++) factors[c][j] /= f0;
+    }
+
+    // Remaining factor on the grid of the other variables, the separated ones being at x0
+    vector<vector<double> > rest_axes(axes);
+    for (unsigned int c : sep) rest_axes[c].assign(1, axes[c][x0[c]]);
+    size_t nrest = 1;
+    for (unsigned int i=0; i<ndim; i++) nrest *= rest_axes[i].size();
+    vector<double> rest(nrest);
+    function->valuesAtGrid(rest_axes, &rest[0], layout, chunk_size);
+
+    // Products, row by row along the fastest varying axis,
+    // the multi-index of the other axes being incremented like an odometer in the order of the layout
+    vector<unsigned int> order(ndim);
+    for (unsigned int k=0; k<ndim; k++) order[k] = (layout==layout_rowMajor) ? ndim-1-k : k;
+    vector<size_t> rest_stride(ndim, 0);
+    size_t stride = 1;
+    for (unsigned int k=0; k<ndim; k++) {
+        unsigned int i = order[k];
+        if (rest_axes[i].size() > 1) rest_stride[i] = stride;
+        stride *= rest_axes[i].size();
+    }
+    unsigned int fast = order[0];
+    size_t nrow = axes[fast].size(), fast_stride = rest_stride[fast];
+    const double * fast_factor = factors[fast].empty() ? NULL : &factors[fast][0];
+    vector<size_t> index(ndim, 0);
+    size_t r = 0;
+    for (size_t start=0; start<npoints; start+=nrow) {
+        double scale = 1.;
+        for (unsigned int c : sep) {
+            if (c != fast) scale *= factors[c][index[c]];
+        }
+        double * row = values + start;
+        const double * rest_row = &rest[r];
+        if (fast_factor) {
+            for (size_t j=0; j<nrow; j++) row[j] = rest_row[0] * scale * fast_factor[j];
+        } else {
+            for (size_t j=0; j<nrow; j++) row[j] = rest_row[j*fast_stride] * scale;
+        }
+        for (unsigned int k=1; k<ndim; k++) {
+            unsigned int i = order[k];
+            if (++index[i] < axes[i].size()) {
+                r += rest_stride[i];
+                break;
+            }
+            r -= rest_stride[i] * (axes[i].size()-1);
+            index[i] = 0;
+        }
+    }
+    separated = sep;
+    return true;
+}
+
+void ProfileFactorization::valuesAtGrid(Function *function, const vector<vector<double> > &axes, double time, double * values,
+                                        ProfileLayout layout, unsigned int chunk_size)
+{
+    time_reused = false;
+    unsigned int ndim = axes.size();
+    size_t npoints = 1;
+    for (unsigned int i=0; i<ndim; i++) npoints *= axes[i].size();
+    if (npoints == 0) return;
+
+    // Same grid as before: the values are the spatial factor times f(x0,t)/f(x0,t_ref)
+    if (function == cached_function && layout == cached_layout && axes == cached_axes) {
+        unsigned int n = cached_points.size();
+        vector<vector<double> > buffer(ndim+1, vector<double>(n, time));
+        vector<double*> coordinates(ndim+1);
+        for (unsigned int p=0; p<n; p++) {
+            size_t rest = cached_points[p];
+            for (unsigned int k=0; k<ndim; k++) {
+                unsigned int i = (layout==layout_rowMajor) ? ndim-1-k : k;
+                buffer[i][p] = axes[i][rest % axes[i].size()];
+                rest /= axes[i].size();
+            }
+        }
+        for (unsigned int i=0; i<=ndim; i++) coordinates[i] = &buffer[i][0];
+        vector<double> f(n);
+        function->valuesAt(coordinates, n, &f[0]);
+        double g0 = cached_values[cached_points[0]], f0 = f[0];
+        // a zero at the reference point does not tell anything about the other points
+        bool separable = f0 != 0. && isfinite(f0);
+        for (unsigned int p=1; p<n && separable; p++) {
+            separable = abs(f[p]*g0 - f0*cached_values[cached_points[p]]) <= tolerance*abs(f0*g0);
+        }
+        // the maximum did not move (e.g. a pulse travelling across the grid)
+        for (unsigned int p=1; p<=cached_neighbours && separable; p++) {
+            separable = abs(f[p]) <= abs(f0);
+        }
+        if (separable) {
+            double ratio = f0 / g0;
+            for (size_t p=0; p<npoints; p++) values[p] = cached_values[p] * ratio;
+            time_reused = true;
+            return;
+        }
+    }
+
+    // Whole grid at this time (factorized in space when possible), which becomes the spatial factor
+    vector<vector<double> > st_axes(axes);
+    st_axes.push_back(vector<double>(1, time));
+    if (!valuesAtGrid(function, st_axes, values, layout, chunk_size)) {
+        function->valuesAtGrid(st_axes, values, layout, chunk_size);
+    }
+    cached_function = NULL;
+    cached_points.clear();
+    size_t ref = 0;
+    for (size_t p=1; p<npoints; p++) {
+        if (abs(values[p]) > abs(values[ref])) ref = p;
+    }
+    if (values[ref] == 0. || !isfinite(values[ref]) || (!assumed && nsamples == 0)) return;
+    // points checked at each time: the reference point, its neighbours along each axis,
+    // and (unless separability is assumed) random points of the grid and random points where the values are significant
+    vector<size_t> points(1, ref);
+    size_t rest = ref, stride = 1;
+    for (unsigned int k=0; k<ndim; k++) {
+        unsigned int i = (layout==layout_rowMajor) ? ndim-1-k : k;
+        size_t index = rest % axes[i].size();
+        if (index > 0) points.push_back(ref - stride);
+        if (index+1 < axes[i].size()) points.push_back(ref + stride);
+        rest /= axes[i].size();
+        stride *= axes[i].size();
+    }
+    unsigned int neighbours = points.size() - 1;
+    if (!assumed) {
+        mt19937 rng(12345);
+        uniform_int_distribution<size_t> dist(0, npoints-1);
+        for (unsigned int p=0; p<nsamples; p++) points.push_back(dist(rng));
+        vector<size_t> significant;
+        for (size_t p=0; p<npoints; p++) {
+            if (abs(values[p]) >= sqrt(tolerance)*abs(values[ref])) significant.push_back(p);
+        }
+        uniform_int_distribution<size_t> pick(0, significant.size()-1);
+        for (unsigned int p=0; p<nsamples; p++) points.push_back(significant[pick(rng)]);
+    }
+    // reusing costs one evaluation per point per time step
+    if (npoints <= 2*points.size()) return;
+    cached_function = function;
+    cached_axes = axes;
+    cached_layout = layout;
+    cached_values.assign(values, values+npoints);
+    cached_points.swap(points);
+    cached_neighbours = neighbours;
+}
+
+string ProfileFactorization::getInfo()
+{
+    if (time_reused) return "spatial factor of a previous time step rescaled";
+    if (separated.empty()) return "not factorized";
+    ostringstream info;
+    info << "factorized along variable" << (separated.size() > 1 ? "s " : " ");
+    for (unsigned int k=0; k<separated.size(); k++) info << (k ? ", " : "") << separated[k];
+    return info.str();
+}
+
+void ProfileFactorization::valuesAtIndices(Function *function, const vector<vector<double> > &axes,
+                                           const vector<vector<size_t> > &indices, double * values)
+{
+    unsigned int ndim = axes.size();
+    unsigned int npoints = indices[0].size();
+    vector<vector<double> > buffer(ndim, vector<double>(npoints));
+    vector<double*> coordinates(ndim);
+    for (unsigned int i=0; i<ndim; i++) {
+        for (unsigned int p=0; p<npoints; p++) buffer[i][p] = axes[i][indices[i][p]];
+        coordinates[i] = &buffer[i][0];
+    }
+    function->valuesAt(coordinates, npoints, values);
+}
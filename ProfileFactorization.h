@@ -0,0 +1,63 @@
+#ifndef ProfileFactorization_H
+#define ProfileFactorization_H
+
+#include <vector>
+#include <string>
+#include "Profile.h"
+
+//  -------------------------------------------------------------------------------------------
+//! Evaluation of a profile on a grid as a product of factors, when it is separable, e.g.
+//! f(x,y,z) = a(x) b(y) c(z) costs nx+ny+nz evaluations instead of nx*ny*nz.
+//! Separability is probed on random points of the grid: with x0 the sampled point where |f| is
+//! the largest, f is separable in the variable i when f(x) f(x0) = f(x_i, x0_others) f(x0_i, x_others)
+//! within tolerance * f(x0)^2. The variables that are not separable form one remaining factor,
+//! e.g. f(x,y) env(t) is evaluated as nx*ny + nt values. Samples where |f| is negligible pass this test
+//! whatever f is, so a function significant on less than a quarter of the samples is evaluated as a whole.
+//! For space-time grids at successive times, the spatial factor is kept between calls and each new
+//! time only costs the evaluation at the reference point, at its neighbours and at the sampled points
+//! (checking that the profile still is the spatial factor times a function of time, and that its maximum
+//! did not move); half of the sampled points are drawn where the spatial factor is significant.
+//! The namelist can set `separable = True` on the function (no probing) or `separable = False`.
+//  -------------------------------------------------------------------------------------------
+class ProfileFactorization
+{
+public:
+    //! With assumed, the function is declared separable in all its variables
+    ProfileFactorization(double tolerance, unsigned int nsamples, bool assumed);
+
+    //! Same as Function::valuesAtGrid; returns false when the grid is not worth factorizing
+    //! or when the function is not separable on it (values are then untouched)
+    bool valuesAtGrid(Function *function, const std::vector<std::vector<double> > &axes, double * values,
+                      ProfileLayout layout, unsigned int chunk_size);
+
+    //! Same for a space-time profile at a given time (axes are the spatial axes), always fills values
+    void valuesAtGrid(Function *function, const std::vector<std::vector<double> > &axes, double time, double * values,
+                      ProfileLayout layout, unsigned int chunk_size);
+
+    //! Description of the last factorization
+    std::string getInfo();
+
+private:
+    double tolerance;
+    unsigned int nsamples;
+    bool assumed;
+    //! variables found separable on the last grid (empty when it was evaluated as a whole)
+    std::vector<unsigned int> separated;
+    //! a previous time step was reused
+    bool time_reused;
+
+    //! Spatial factor of the last space-time grid: values at time_ref, and the points checked at each time
+    Function * cached_function;
+    std::vector<std::vector<double> > cached_axes;
+    ProfileLayout cached_layout;
+    std::vector<double> cached_values;
+    //! indices of the reference point (largest value), of its cached_neighbours neighbours and of the sampled points in cached_values
+    std::vector<size_t> cached_points;
+    unsigned int cached_neighbours;
+
+    //! Values of function at npoints points given by the indices of each variable in axes
+    static void valuesAtIndices(Function *function, const std::vector<std::vector<double> > &axes,
+                                const std::vector<std::vector<size_t> > &indices, double * values);
+};
+
+#endif
@@ -0,0 +1,117 @@
+#include <sstream>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "ProfileGridCache.h"
+#include "NamelistSnapshot.h"
+
+using namespace std;
+
+// first word of the files ("nicogrid")
+static const uint64_t magic = 0x646972676f63696eULL;
+
+ProfileGridCache::ProfileGridCache(Profile &profile, vector<vector<double> > axes, ProfileLayout layout, unsigned int chunk_size) :
+    npoints(0),
+    data(NULL),
+    mapped(NULL),
+    mapped_size(0),
+    stored(false)
+{
+    init(profile, axes, false, 0., layout, chunk_size);
+}
+
+ProfileGridCache::ProfileGridCache(Profile &profile, vector<vector<double> > axes, double time, ProfileLayout layout, unsigned int chunk_size) :
+    npoints(0),
+    data(NULL),
+    mapped(NULL),
+    mapped_size(0),
+    stored(false)
+{
+    init(profile, axes, true, time, layout, chunk_size);
+}
+
+ProfileGridCache::~ProfileGridCache()
+{
+    if (mapped) munmap(mapped, mapped_size);
+}
+
+void ProfileGridCache::init(Profile &profile, vector<vector<double> > &axes, bool with_time, double time,
+                            ProfileLayout layout, unsigned int chunk_size)
+{
+    npoints = 1;
+    for (unsigned int i=0; i<axes.size(); i++) npoints *= axes[i].size();
+    
+    // Keys of the function and of the grid (variables, nodes, layout and time)
+    string fingerprint = profile.getFingerprint(), dir;
+    if (!fingerprint.empty() && !NamelistSnapshot::replaying()) dir = PyTools::cacheDirectory();
+    if (!dir.empty()) {
+        ostringstream geometry;
+        geometry << profile.getNvariables() << " " << axes.size() << " " << (int) layout;
+        if (with_time) geometry << " t" << hexfloat << time;
+        for (unsigned int i=0; i<axes.size(); i++) {
+            geometry << ";" << axes[i].size() << ":";
+            geometry.write((const char*) axes[i].data(), axes[i].size() * sizeof(double));
+        }
+        ostringstream p;
+        p << dir << "/grid-" << hex << PyTools::hashString(fingerprint) << "-" << PyTools::hashString(geometry.str()) << ".bin";
+        path = p.str();
+        // the header holds the whole keys (the name only has their hashes), padded so that the values are aligned
+        uint64_t sizes[4] = { magic, (uint64_t) npoints, (uint64_t) fingerprint.size(), (uint64_t) geometry.str().size() };
+        string header((const char*) sizes, sizeof(sizes));
+        header += fingerprint + geometry.str();
+        header.resize((header.size() + sizeof(double)-1) / sizeof(double) * sizeof(double), '\0');
+        if (map(header)) return;
+        
+        // evaluated once and stored
+        memory.resize(npoints);
+        if (with_time) profile.valuesAtGrid(axes, time, memory.data(), layout, chunk_size);
+        else           profile.valuesAtGrid(axes, memory.data(), layout, chunk_size);
+        stored = PyTools::writeFileAtomically(path, header, (const char*) memory.data(), npoints * sizeof(double));
+        if (map(header)) {
+            vector<double>().swap(memory);
+        } else {
+            data = memory.data();
+        }
+        return;
+    }
+    
+    memory.resize(npoints);
+    if (with_time) profile.valuesAtGrid(axes, time, memory.data(), layout, chunk_size);
+    else           profile.valuesAtGrid(axes, memory.data(), layout, chunk_size);
+    data = memory.data();
+}
+
+bool ProfileGridCache::map(const string &header)
+{
+    size_t header_size = header.size();
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+    struct stat st;
+    size_t size = header_size + npoints * sizeof(double);
+    void * address = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && (size_t) st.st_size == size) {
+        address = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if (address == MAP_FAILED) return false;
+    // a file of the right size but of another grid or function (hash collision) is ignored
+    if (memcmp(address, header.data(), header_size) != 0) {
+        munmap(address, size);
+        return false;
+    }
+    mapped = address;
+    mapped_size = size;
+    data = (const double *) ((const char *) address + header_size);
+    return true;
+}
+
+string ProfileGridCache::getInfo()
+{
+    if (mapped && !stored) return "mapped from " + path;
+    if (stored) return "evaluated and stored in " + path;
+    return "evaluated (not cached)";
+}
@@ -0,0 +1,67 @@
+#ifndef ProfileGridCache_H
+#define ProfileGridCache_H
+
+#include <vector>
+#include <string>
+#include <stdint.h>
+#include "Profile.h"
+
+//  -------------------------------------------------------------------------------------------
+//! Values of a profile on a rectilinear grid, kept on disk for the next runs (restarts, ensembles).
+//! The file, in PyTools::cacheDirectory(), is named after the fingerprint of the profile (hash of
+//! the bytecode, constants, closure and globals of the function, see Profile::getFingerprint)
+//! and after the geometry of the grid (64-bit hashes); its header holds both in full, so that a file
+//! of another profile or grid with the same name is ignored. When it exists, it is memory-mapped
+//! read-only instead of evaluating the profile: pages are read on demand and shared by the processes of the node.
+//! Otherwise the grid is evaluated with Profile::valuesAtGrid and stored (written aside then renamed).
+//! Profiles without fingerprint, or without cache directory, are simply evaluated.
+//  -------------------------------------------------------------------------------------------
+class ProfileGridCache
+{
+public:
+    //! Values of the profile on the grid axes (all the variables), as Profile::valuesAtGrid
+    ProfileGridCache(Profile &profile, std::vector<std::vector<double> > axes, ProfileLayout layout=layout_rowMajor,
+                     unsigned int chunk_size=65536);
+    //! Same for a space-time profile at a given time (spatial axes only)
+    ProfileGridCache(Profile &profile, std::vector<std::vector<double> > axes, double time, ProfileLayout layout=layout_rowMajor,
+                     unsigned int chunk_size=65536);
+    ~ProfileGridCache();
+    
+    //! Values on the grid (read-only), valid during the lifetime of the object
+    inline const double * values() {
+        return data;
+    };
+    
+    //! Number of points of the grid
+    inline size_t size() {
+        return npoints;
+    };
+    
+    //! Whether the values were mapped from a previous run
+    inline bool wasCached() {
+        return mapped && !stored;
+    };
+    
+    //! Where the values come from
+    std::string getInfo();
+    
+private:
+    std::string path;
+    size_t npoints;
+    const double * data;
+    //! mapping of the file (NULL when the values are in memory)
+    void * mapped;
+    size_t mapped_size;
+    //! whether the values were evaluated in this run
+    bool stored;
+    //! values when they could not be mapped
+    std::vector<double> memory;
+    
+    void init(Profile &profile, std::vector<std::vector<double> > &axes, bool with_time, double time,
+              ProfileLayout layout, unsigned int chunk_size);
+    
+    //! Maps the file if its header matches (magic, number of points, fingerprint and geometry)
+    bool map(const std::string &header);
+};
+
+#endif
@@ -0,0 +1,252 @@
+#include <queue>
+#include <limits>
+#include <algorithm>
+
+#include "ProfileIntegrator.h"
+
+using namespace std;
+
+// Nodes of the 15-point Kronrod rule on [-1,1] (the odd ones are the nodes of the 7-point Gauss rule)
+static const double xgk[8] = {
+    0.991455371120812639206854697526329, 0.949107912342758524526189684047851,
+    0.864864423359769072789712788640926, 0.741531185599394439863864773280788,
+    0.586087235467691130294144845693013, 0.405845151377397166906606412076961,
+    0.207784955007898467600689403773245, 0.
+};
+static const double wgk[8] = {
+    0.022935322010529224963732008058970, 0.063092092629978553290700663189204,
+    0.104790010322250183839876322541518, 0.140653259715525918745189590510238,
+    0.169004726639267902826583426598550, 0.190350578064785409913256402421014,
+    0.204432940075298892414161999234649, 0.209482141084727828012999174891714
+};
+static const double wg[4] = {
+    0.129484966168869693270611432679082, 0.279705391489276667901467771423780,
+    0.381830050505118944950369775488975, 0.417959183673469387755102040816327
+};
+
+// Node k of the 15 nodes in increasing order, with its Kronrod and Gauss weights (0 outside the Gauss nodes)
+static inline double node(unsigned int k) {
+    return k < 7 ? -xgk[k] : (k == 7 ? 0. : xgk[14-k]);
+}
+static inline double kronrodWeight(unsigned int k) {
+    return wgk[k < 8 ? k : 14-k];
+}
+static inline double gaussWeight(unsigned int k) {
+    unsigned int j = k < 8 ? k : 14-k;
+    return (j % 2) ? wg[j/2] : 0.;
+}
+
+// Error of the Kronrod rule from the difference with the Gauss rule, as in QUADPACK (qk15): the difference
+// is rescaled by the variation of the integrand (resasc) and bounded below by the rounding errors (resabs)
+static inline double kronrodError(double difference, double resasc, double resabs)
+{
+    double error = difference;
+    if (resasc != 0. && error != 0.) error = resasc * min(1., pow(200.*error/resasc, 1.5));
+    return max(error, 50. * numeric_limits<double>::epsilon() * resabs);
+}
+
+namespace {
+    //! Sub-box with its integrals (Kronrod rule) and their errors (difference with the Gauss rule)
+    struct Box {
+        vector<double> lo, hi;
+        vector<double> value, error;
+        //! error of the integral of f due to each variable (Gauss rule along it only)
+        vector<double> variable_error;
+        bool operator<(const Box &other) const {
+            return error[0] < other.error[0];
+        };
+    };
+}
+
+// All the sub-boxes in one batch of points
+static void evaluateBoxes(Profile &profile, vector<Box> &boxes, bool with_moments)
+{
+    unsigned int ndim = boxes[0].lo.size();
+    unsigned int nm = with_moments ? 1 + 2*ndim : 1;
+    size_t nnodes = 1;
+    for (unsigned int i=0; i<ndim; i++) nnodes *= 15;
+    size_t npoints = nnodes * boxes.size();
+    vector<vector<double> > buffer(ndim, vector<double>(npoints));
+    vector<double*> coordinates(ndim);
+    for (unsigned int i=0; i<ndim; i++) coordinates[i] = &buffer[i][0];
+    vector<unsigned int> k(ndim, 0);
+    for (size_t b=0, p=0; b<boxes.size(); b++) {
+        for (size_t q=0; q<nnodes; q++, p++) {
+            for (unsigned int i=0; i<ndim; i++) {
+                double center = 0.5*(boxes[b].lo[i]+boxes[b].hi[i]), half = 0.5*(boxes[b].hi[i]-boxes[b].lo[i]);
+                buffer[i][p] = center + half * node(k[i]);
+            }
+            for (int i=ndim-1; i>=0; i--) {
+                if (++k[i] < 15) break;
+                k[i] = 0;
+            }
+        }
+    }
+    vector<double> f(npoints);
+    profile.valuesAt(coordinates, npoints, &f[0]);
+
+    // the Kronrod weights add up to 2^ndim
+    double wsum = pow(2., ndim);
+    vector<double> kronrod(nm), gauss(nm), partial(ndim), resasc(nm), resabs(nm);
+    for (size_t b=0, p=0; b<boxes.size(); b++) {
+        Box &box = boxes[b];
+        size_t first = p;
+        fill(kronrod.begin(), kronrod.end(), 0.);
+        fill(gauss.begin(), gauss.end(), 0.);
+        fill(partial.begin(), partial.end(), 0.);
+        for (size_t q=0; q<nnodes; q++, p++) {
+            double wk = 1., wgauss = 1.;
+            for (unsigned int i=0; i<ndim; i++) {
+                wk *= kronrodWeight(k[i]);
+                wgauss *= gaussWeight(k[i]);
+            }
+            double fk = f[p] * wk, fg = f[p] * wgauss;
+            kronrod[0] += fk;
+            gauss[0] += fg;
+            for (unsigned int i=0; i<ndim; i++) {
+                partial[i] += fk * gaussWeight(k[i]) / kronrodWeight(k[i]);
+            }
+            if (with_moments) {
+                for (unsigned int i=0; i<ndim; i++) {
+                    double x = buffer[i][p];
+                    kronrod[1+i] += fk * x;
+                    gauss[1+i] += fg * x;
+                    kronrod[1+ndim+i] += fk * x*x;
+                    gauss[1+ndim+i] += fg * x*x;
+                }
+            }
+            for (int i=ndim-1; i>=0; i--) {
+                if (++k[i] < 15) break;
+                k[i] = 0;
+            }
+        }
+        // integrals of |g| and |g - mean of g| for each integrand g
+        fill(resasc.begin(), resasc.end(), 0.);
+        fill(resabs.begin(), resabs.end(), 0.);
+        for (size_t q=0, r=first; q<nnodes; q++, r++) {
+            double wk = 1.;
+            for (unsigned int i=0; i<ndim; i++) wk *= kronrodWeight(k[i]);
+            for (unsigned int m=0; m<nm; m++) {
+                double g = f[r];
+                if (m > 0) {
+                    double x = buffer[(m-1) % ndim][r];
+                    g *= (m > ndim) ? x*x : x;
+                }
+                resabs[m] += wk * abs(g);
+                resasc[m] += wk * abs(g - kronrod[m]/wsum);
+            }
+            for (int i=ndim-1; i>=0; i--) {
+                if (++k[i] < 15) break;
+                k[i] = 0;
+            }
+        }
+        double volume = 1.;
+        for (unsigned int i=0; i<ndim; i++) volume *= 0.5*(box.hi[i]-box.lo[i]);
+        box.value.resize(nm);
+        box.error.resize(nm);
+        box.variable_error.resize(ndim);
+        for (unsigned int m=0; m<nm; m++) {
+            box.value[m] = kronrod[m] * volume;
+            box.error[m] = kronrodError(abs(kronrod[m] - gauss[m]), resasc[m], resabs[m]) * volume;
+        }
+        for (unsigned int i=0; i<ndim; i++) box.variable_error[i] = abs(kronrod[0] - partial[i]) * volume;
+    }
+}
+
+ProfileIntegrator::ProfileIntegrator(double tolerance, double abs_tolerance, size_t max_evaluations) :
+    tolerance(tolerance),
+    abs_tolerance(abs_tolerance),
+    max_evaluations(max_evaluations),
+    evaluations(0),
+    nboxes(0),
+    converged(false)
+{
+}
+
+double ProfileIntegrator::integrate(Profile &profile, vector<double> xmin, vector<double> xmax, double * error)
+{
+    ProfileMoments result = integrateBoxes(profile, xmin, xmax, false);
+    if (error) *error = result.integral_error;
+    return result.integral;
+}
+
+ProfileMoments ProfileIntegrator::moments(Profile &profile, vector<double> xmin, vector<double> xmax)
+{
+    return integrateBoxes(profile, xmin, xmax, true);
+}
+
+ProfileMoments ProfileIntegrator::integrateBoxes(Profile &profile, const vector<double> &xmin, const vector<double> &xmax,
+                                                 bool with_moments)
+{
+    ProfileMoments result;
+    result.integral = result.integral_error = 0.;
+    result.evaluations = 0;
+    evaluations = nboxes = 0;
+    converged = false;
+    unsigned int ndim = xmin.size();
+    if (ndim == 0 || ndim != xmax.size() || ndim != profile.getNvariables()) {
+        ERROR("ProfileIntegrator: the box has " << ndim << " variables but the profile has " << profile.getNvariables());
+        return result;
+    }
+    size_t nnodes = 1;
+    for (unsigned int i=0; i<ndim; i++) nnodes *= 15;
+
+    vector<Box> batch(1);
+    batch[0].lo = xmin;
+    batch[0].hi = xmax;
+    evaluateBoxes(profile, batch, with_moments);
+    result.evaluations = nnodes;
+    double integral = batch[0].value[0], error = batch[0].error[0];
+    priority_queue<Box> boxes;
+    boxes.push(batch[0]);
+
+    // Cut the worst sub-box in two along the variable that contributes most to its error
+    while (true) {
+        if (error <= max(tolerance*abs(integral), abs_tolerance)) {
+            converged = true;
+            break;
+        }
+        if (result.evaluations + 2*nnodes > max_evaluations) break;
+        Box worst = boxes.top();
+        boxes.pop();
+        unsigned int cut = max_element(worst.variable_error.begin(), worst.variable_error.end()) - worst.variable_error.begin();
+        double middle = 0.5*(worst.lo[cut]+worst.hi[cut]);
+        batch.assign(2, worst);
+        batch[0].hi[cut] = middle;
+        batch[1].lo[cut] = middle;
+        evaluateBoxes(profile, batch, with_moments);
+        result.evaluations += 2*nnodes;
+        integral += batch[0].value[0] + batch[1].value[0] - worst.value[0];
+        error += batch[0].error[0] + batch[1].error[0] - worst.error[0];
+        boxes.push(batch[0]);
+        boxes.push(batch[1]);
+    }
+
+    // Sums over the sub-boxes (without the rounding errors of the updates above)
+    nboxes = boxes.size();
+    evaluations = result.evaluations;
+    result.first.assign(with_moments ? ndim : 0, 0.);
+    result.first_error = result.second = result.second_error = result.first;
+    while (!boxes.empty()) {
+        const Box &box = boxes.top();
+        result.integral += box.value[0];
+        result.integral_error += box.error[0];
+        for (unsigned int i=0; i<result.first.size(); i++) {
+            result.first[i] += box.value[1+i];
+            result.first_error[i] += box.error[1+i];
+            result.second[i] += box.value[1+ndim+i];
+            result.second_error[i] += box.error[1+ndim+i];
+        }
+        boxes.pop();
+    }
+    if (!converged) {
+        ERROR("ProfileIntegrator: error " << result.integral_error << " after " << result.evaluations << " evaluations");
+    }
+    return result;
+}
+
+string ProfileIntegrator::getInfo()
+{
+    return to_string(evaluations) + " evaluations in " + to_string(nboxes) + " sub-box" + (nboxes > 1 ? "es" : "")
+         + (converged ? "" : " (not converged)");
+}
@@ -0,0 +1,65 @@
+#ifndef ProfileIntegrator_H
+#define ProfileIntegrator_H
+
+#include <vector>
+#include <string>
+#include <cmath>
+#include <algorithm>
+#include "Profile.h"
+
+//! Integral of a profile over a box and its first moments along each variable, with their error estimates
+struct ProfileMoments {
+    //! integral of f
+    double integral, integral_error;
+    //! integrals of x_i f and x_i^2 f
+    std::vector<double> first, first_error, second, second_error;
+    //! number of evaluations of the profile
+    size_t evaluations;
+
+    //! mean of the variable i weighted by the profile
+    inline double centroid(unsigned int i) {
+        return first[i] / integral;
+    };
+    //! rms width along the variable i around the centroid
+    inline double rms(unsigned int i) {
+        double c = centroid(i);
+        return std::sqrt(std::max(0., second[i] / integral - c*c));
+    };
+};
+
+//  -------------------------------------------------------------------------------------------
+//! Adaptive cubature of profiles: the box is covered by sub-boxes each integrated by the tensor
+//! product of 15-point Gauss-Kronrod rules along each variable (15^d points, evaluated in one
+//! Profile::valuesAt). The difference with the embedded 7-point Gauss rule, rescaled as in QUADPACK,
+//! estimates the error of each sub-box; the sub-box with the largest error is cut in two along the variable that
+//! contributes most to it, until the total error is below the tolerance.
+//! The moments x_i f and x_i^2 f are integrated from the same evaluations as f.
+//  -------------------------------------------------------------------------------------------
+class ProfileIntegrator
+{
+public:
+    //! Stops when the estimated error of the integral is below max(tolerance*|integral|, abs_tolerance),
+    //! or when the next sub-boxes would exceed max_evaluations
+    ProfileIntegrator(double tolerance=1e-8, double abs_tolerance=0., size_t max_evaluations=1000000);
+
+    //! Integral of the profile over [xmin[0], xmax[0]] x [xmin[1], xmax[1]] x ... (all the variables)
+    double integrate(Profile &profile, std::vector<double> xmin, std::vector<double> xmax, double * error=NULL);
+
+    //! Integral and moments of the profile over the same box
+    ProfileMoments moments(Profile &profile, std::vector<double> xmin, std::vector<double> xmax);
+
+    //! Number of evaluations and of sub-boxes of the last integration, and whether it converged
+    std::string getInfo();
+
+private:
+    double tolerance, abs_tolerance;
+    size_t max_evaluations;
+    size_t evaluations, nboxes;
+    bool converged;
+
+    //! Integrals of f, x_i f and x_i^2 f (only f without moments) and their errors
+    ProfileMoments integrateBoxes(Profile &profile, const std::vector<double> &xmin, const std::vector<double> &xmax,
+                                  bool with_moments);
+};
+
+#endif
@@ -0,0 +1,105 @@
+#include "ProfilePrefetcher.h"
+
+using namespace std;
+
+ProfilePrefetcher::ProfilePrefetcher(Profile &p, vector<vector<double> > ax, double t, double d, ProfileLayout l) :
+    profile(p),
+    axes(ax),
+    layout(l),
+    npoints(1),
+    t0(t),
+    dt(d)
+{
+    for (unsigned int i=0; i<axes.size(); i++) npoints *= axes[i].size();
+    start(axes.size());
+}
+
+ProfilePrefetcher::ProfilePrefetcher(Profile &p, vector<double*> coordinates, unsigned int n, double t, double d) :
+    profile(p),
+    layout(layout_rowMajor),
+    points(coordinates.size()),
+    npoints(n),
+    t0(t),
+    dt(d)
+{
+    for (unsigned int i=0; i<coordinates.size(); i++) points[i].assign(coordinates[i], coordinates[i]+n);
+    start(coordinates.size());
+}
+
+void ProfilePrefetcher::start(unsigned int nspatial)
+{
+    gil = NULL;
+    // not started: next() returns NULL
+    if (!profile.isSpaceTime()) {
+        ERROR("Profile prefetch: the profile does not depend on time");
+        return;
+    }
+    if (nspatial+1 != profile.getNvariables()) {
+        ERROR("Profile prefetch: " << nspatial << " spatial variables but the profile has " << profile.getNvariables() << " variables");
+        return;
+    }
+    buffers[0].resize(npoints);
+    buffers[1].resize(npoints);
+    computed = 0;
+    released = 0;
+    handed = 0;
+    stop = false;
+    gil = new PyTools::GILRelease();
+    helper = thread(&ProfilePrefetcher::run, this);
+}
+
+ProfilePrefetcher::~ProfilePrefetcher()
+{
+    if (!isStarted()) return;
+    {
+        lock_guard<mutex> lock(step_mutex);
+        stop = true;
+    }
+    condition.notify_all();
+    helper.join();
+    delete gil;
+}
+
+void ProfilePrefetcher::evaluate(double time, double * buffer)
+{
+    if (npoints == 0) return;
+    if (points.empty()) {
+        profile.valuesAtGrid(axes, time, buffer, layout);
+    } else {
+        vector<double*> coordinates(points.size());
+        for (unsigned int i=0; i<points.size(); i++) coordinates[i] = &points[i][0];
+        profile.valuesAt(coordinates, time, npoints, buffer);
+    }
+}
+
+void ProfilePrefetcher::run()
+{
+    for (unsigned long step=0; ; step++) {
+        // wait until the buffer of step-2 is released
+        {
+            unique_lock<mutex> lock(step_mutex);
+            condition.wait(lock, [&]() { return stop || step < released + 2; });
+            if (stop) return;
+        }
+        evaluate(t0 + step*dt, &buffers[step%2][0]);
+        {
+            lock_guard<mutex> lock(step_mutex);
+            computed = step+1;
+        }
+        condition.notify_all();
+    }
+}
+
+const double * ProfilePrefetcher::next(double * time)
+{
+    if (!isStarted() || npoints == 0) return NULL;
+    unique_lock<mutex> lock(step_mutex);
+    unsigned long step = handed;
+    // the values of the previous step are not used anymore
+    released = step;
+    condition.notify_all();
+    condition.wait(lock, [&]() { return computed > step; });
+    handed = step+1;
+    if (time) *time = t0 + step*dt;
+    return &buffers[step%2][0];
+}
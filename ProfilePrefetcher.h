@@ -0,0 +1,68 @@
+#ifndef ProfilePrefetcher_H
+#define ProfilePrefetcher_H
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include "Profile.h"
+
+//  -------------------------------------------------------------------------------------------
+//! Evaluation of a space-time profile at successive times t0, t0+dt, ... on a helper thread:
+//! the values at step n+1 are computed while the caller uses those of step n (double buffer).
+//! While it exists, the GIL of the creating thread is released: python must be called
+//! from this thread within a PyTools::GILState (Profile does it).
+//  -------------------------------------------------------------------------------------------
+class ProfilePrefetcher
+{
+public:
+    //! On the rectilinear grid axes (spatial variables only)
+    ProfilePrefetcher(Profile &profile, std::vector<std::vector<double> > axes, double t0, double dt,
+                      ProfileLayout layout=layout_rowMajor);
+    //! On a list of points (coordinates[i][p] is the coordinate i of point p, copied)
+    ProfilePrefetcher(Profile &profile, std::vector<double*> coordinates, unsigned int npoints, double t0, double dt);
+    ~ProfilePrefetcher();
+    
+    //! Values at the next time step (waits until they are ready), valid until the following call;
+    //! NULL without points, or when the profile does not depend on time or has other spatial variables
+    const double * next(double * time=NULL);
+    
+    //! Whether the values are computed (the profile and the points match)
+    inline bool isStarted() {
+        return helper.joinable();
+    };
+    
+    //! Number of values per time step
+    inline size_t size() {
+        return npoints;
+    };
+    
+private:
+    //! starts the helper thread, unless the profile is not a space-time profile of nspatial+1 variables
+    void start(unsigned int nspatial);
+    //! loop of the helper thread
+    void run();
+    //! values at time in buffer
+    void evaluate(double time, double * buffer);
+    
+    Profile &profile;
+    std::vector<std::vector<double> > axes;
+    ProfileLayout layout;
+    //! copy of the points when not on a grid
+    std::vector<std::vector<double> > points;
+    size_t npoints;
+    double t0, dt;
+    
+    //! values of two successive time steps
+    std::vector<double> buffers[2];
+    //! number of steps computed, given to the caller, and released by the caller
+    unsigned long computed, handed, released;
+    bool stop;
+    std::mutex step_mutex;
+    std::condition_variable condition;
+    std::thread helper;
+    //! GIL of the creating thread, released during the lifetime of the object
+    PyTools::GILRelease * gil;
+};
+
+#endif
@@ -0,0 +1,100 @@
+#include <vector>
+#include <sstream>
+
+#include "ProfileRegistry.h"
+#include "Profile.h"
+
+using namespace std;
+
+// the keys start with the interpreter: each sub-interpreter has its own python objects
+static string interpreterPrefix()
+{
+    ostringstream prefix;
+    prefix << (void *) PyThreadState_Get()->interp << " ";
+    return prefix.str();
+}
+
+string ProfileRegistry::objectKey(PyObject *py_object)
+{
+    ostringstream key;
+    key << interpreterPrefix() << "object " << (void *) py_object;
+    return key.str();
+}
+
+string ProfileRegistry::fingerprintKey(const string &fingerprint)
+{
+    if (fingerprint.empty()) return "";
+    return interpreterPrefix() + "code " + fingerprint;
+}
+
+bool ProfileRegistry::find(const string &key, Entry &entry)
+{
+    State &s = state();
+    lock_guard<mutex> lock(s.mutex);
+    map<string, Slot>::iterator slot = s.slots.find(key);
+    if (slot == s.slots.end()) return false;
+    entry.function = slot->second.function.lock();
+    if (!entry.function) return false;
+    entry.nvariables = slot->second.nvariables;
+    entry.fingerprint = slot->second.fingerprint;
+    entry.key = slot->second.key;
+    s.reused++;
+    return true;
+}
+
+shared_ptr<Function> ProfileRegistry::share(Function *function)
+{
+    if (!function) return shared_ptr<Function>();
+    {
+        State &s = state();
+        lock_guard<mutex> lock(s.mutex);
+        s.created++;
+    }
+    return shared_ptr<Function>(function, [](Function *f) {
+        delete f;
+        removeExpired();
+    });
+}
+
+void ProfileRegistry::add(const string &key, const Entry &entry, PyObject *owner)
+{
+    if (key.empty() || !entry.function) return;
+    PyTools::PyRef replaced;
+    {
+        State &s = state();
+        lock_guard<mutex> lock(s.mutex);
+        Slot &slot = s.slots[key];
+        slot.function = entry.function;
+        slot.nvariables = entry.nvariables;
+        slot.fingerprint = entry.fingerprint;
+        slot.key = entry.key.empty() ? key : entry.key;
+        replaced = PyTools::PyRef::borrow(owner);
+        swap(replaced, slot.owner);
+    }
+}
+
+void ProfileRegistry::removeExpired()
+{
+    // the python objects are released after unlocking (it may need the GIL, held by a thread waiting for the lock)
+    vector<PyObject *> owners;
+    {
+        State &s = state();
+        lock_guard<mutex> lock(s.mutex);
+        for (map<string, Slot>::iterator slot=s.slots.begin(); slot!=s.slots.end(); ) {
+            if (slot->second.function.expired()) {
+                owners.push_back(slot->second.owner.release());
+                slot = s.slots.erase(slot);
+            } else {
+                slot++;
+            }
+        }
+    }
+    for (unsigned int i=0; i<owners.size(); i++) PyTools::PyRef release(owners[i]);
+}
+
+string ProfileRegistry::getInfo()
+{
+    State &s = state();
+    lock_guard<mutex> lock(s.mutex);
+    return to_string(s.created) + " functions created, " + to_string(s.reused) + " reused";
+}
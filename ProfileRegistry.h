@@ -0,0 +1,69 @@
+#ifndef ProfileRegistry_H
+#define ProfileRegistry_H
+
+#include <string>
+#include <map>
+#include <memory>
+#include <mutex>
+#include "PyTools.h"
+
+class Function;
+
+//  -------------------------------------------------------------------------------------------
+//! Functions evaluating profiles, shared by all the profiles built from the same python function
+//! (e.g. extract3Profiles returning one function for the 3 components, or species sharing a density).
+//! A function is registered under the identity of the python object (which is kept alive meanwhile)
+//! and under its fingerprint (same bytecode, constants and globals, see Profile::getFingerprint),
+//! and its tables under the parameters of the tabulation. The entries of the current interpreter
+//! only are visible, and they disappear with the last profile using the function.
+//  -------------------------------------------------------------------------------------------
+class ProfileRegistry {
+public:
+    //! Function registered under a key, with its number of variables, fingerprint,
+    //! and main key (the one from which the keys of its tables are made)
+    struct Entry {
+        std::shared_ptr<Function> function;
+        unsigned int nvariables;
+        std::string fingerprint, key;
+    };
+    
+    //! Key of a python object (its identity)
+    static std::string objectKey(PyObject *py_object);
+    //! Key of a python function with the given fingerprint ("" for an empty fingerprint)
+    static std::string fingerprintKey(const std::string &fingerprint);
+    
+    //! Whether a live function is registered under key (then found in entry)
+    static bool find(const std::string &key, Entry &entry);
+    
+    //! Function given to the registry: deleted with the last profile using it, which also removes its entries
+    static std::shared_ptr<Function> share(Function *function);
+    
+    //! Registers entry under key (owner, if any, is kept alive as long as the entry)
+    static void add(const std::string &key, const Entry &entry, PyObject *owner=NULL);
+    
+    //! Number of functions created and of profiles that reused one
+    static std::string getInfo();
+    
+private:
+    struct Slot {
+        std::weak_ptr<Function> function;
+        unsigned int nvariables;
+        std::string fingerprint, key;
+        PyTools::PyRef owner;
+    };
+    struct State {
+        std::mutex mutex;
+        std::map<std::string, Slot> slots;
+        size_t created, reused;
+        State() : created(0), reused(0) {};
+    };
+    static State& state() {
+        static State s;
+        return s;
+    }
+    
+    //! Removes the entries of the functions that were deleted
+    static void removeExpired();
+};
+
+#endif
@@ -0,0 +1,158 @@
+#include <cmath>
+#include <thread>
+#include <algorithm>
+
+#include "ProfileSampler.h"
+
+using namespace std;
+
+// Finalizer of splitmix64: the random number j of particle k is mix(key + counter * golden ratio)
+static inline uint64_t mix(uint64_t z)
+{
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+static const uint64_t golden = 0x9E3779B97F4A7C15ULL;
+
+// uniform in [0,1)
+static inline double uniform(uint64_t r)
+{
+    return (r >> 11) * (1./9007199254740992.);
+}
+
+ProfileSampler::ProfileSampler(Profile &profile, vector<vector<double> > edges) :
+    edges(edges),
+    total_weight(0.)
+{
+    init(profile);
+}
+
+ProfileSampler::ProfileSampler(Profile &profile, vector<double> xmin, vector<double> xmax, vector<unsigned int> ncells) :
+    total_weight(0.)
+{
+    if (xmin.size() != ncells.size() || xmax.size() != ncells.size()) {
+        ERROR("ProfileSampler: xmin, xmax and ncells must have one value per variable");
+        return;
+    }
+    for (unsigned int i=0; i<ncells.size(); i++) {
+        vector<double> e(ncells[i]+1);
+        for (unsigned int j=0; j<=ncells[i]; j++) e[j] = xmin[i] + (xmax[i]-xmin[i]) * j / ncells[i];
+        edges.push_back(e);
+    }
+    init(profile);
+}
+
+void ProfileSampler::init(Profile &profile)
+{
+    unsigned int ndim = edges.size();
+    if (ndim != profile.getNvariables()) {
+        ERROR("ProfileSampler: " << ndim << " axes for a profile of " << profile.getNvariables() << " variables");
+        return;
+    }
+    // Centers of the cells, the last variable varying fastest
+    vector<vector<double> > centers(ndim);
+    size_t ncells = 1;
+    for (unsigned int i=0; i<ndim; i++) {
+        if (edges[i].size() < 2) {
+            ERROR("ProfileSampler: variable " << i << " needs at least 2 edges");
+            return;
+        }
+        for (unsigned int j=0; j+1<edges[i].size(); j++) centers[i].push_back(0.5*(edges[i][j]+edges[i][j+1]));
+        ncells *= centers[i].size();
+    }
+    vector<double> weight(ncells);
+    profile.valuesAtGrid(centers, &weight[0], layout_rowMajor);
+
+    // Weights: density times volume (negative or undefined densities are ignored)
+    vector<size_t> index(ndim, 0);
+    size_t ignored = 0;
+    for (size_t c=0; c<ncells; c++) {
+        double volume = 1.;
+        for (unsigned int i=0; i<ndim; i++) volume *= edges[i][index[i]+1] - edges[i][index[i]];
+        if (weight[c] < 0. || !isfinite(weight[c])) {
+            weight[c] = 0.;
+            ignored++;
+        }
+        weight[c] *= abs(volume);
+        total_weight += weight[c];
+        for (int i=ndim-1; i>=0; i--) {
+            if (++index[i] < centers[i].size()) break;
+            index[i] = 0;
+        }
+    }
+    if (ignored) ERROR("ProfileSampler: profile negative or undefined in " << ignored << " cells (ignored)");
+    if (!(total_weight > 0.) || !isfinite(total_weight)) {
+        ERROR("ProfileSampler: profile zero everywhere in the domain");
+        total_weight = 0.;
+        return;
+    }
+
+    // Alias table (Vose): cells below the mean weight are completed by cells above it
+    probability.resize(ncells);
+    alias.resize(ncells);
+    vector<size_t> small, large;
+    for (size_t c=0; c<ncells; c++) {
+        probability[c] = weight[c] * ncells / total_weight;
+        alias[c] = c;
+        if (probability[c] < 1.) small.push_back(c);
+        else                     large.push_back(c);
+    }
+    while (!small.empty() && !large.empty()) {
+        size_t s = small.back(), l = large.back();
+        small.pop_back();
+        alias[s] = l;
+        probability[l] -= 1. - probability[s];
+        if (probability[l] < 1.) {
+            large.pop_back();
+            small.push_back(l);
+        }
+    }
+    // what remains is 1 up to rounding errors
+    for (size_t c : small) probability[c] = 1.;
+    for (size_t c : large) probability[c] = 1.;
+}
+
+void ProfileSampler::sample(size_t npoints, const vector<double*> &positions, uint64_t seed, unsigned int nthreads, uint64_t first)
+{
+    if (npoints == 0 || probability.empty()) return;
+    if (positions.size() != edges.size()) {
+        ERROR("ProfileSampler: " << positions.size() << " coordinate arrays for " << edges.size() << " variables");
+        return;
+    }
+    uint64_t key = mix(seed);
+    if (nthreads == 0) nthreads = max(1u, thread::hardware_concurrency());
+    nthreads = (unsigned int) min((size_t) nthreads, (npoints + 4095) / 4096);
+    if (nthreads <= 1) {
+        sampleRange(first, npoints, positions, 0, key);
+        return;
+    }
+    vector<thread> threads;
+    for (unsigned int t=0; t<nthreads; t++) {
+        size_t begin = npoints * t / nthreads, end = npoints * (t+1) / nthreads;
+        threads.push_back(thread(&ProfileSampler::sampleRange, this, first+begin, end-begin, cref(positions), begin, key));
+    }
+    for (unsigned int t=0; t<nthreads; t++) threads[t].join();
+}
+
+void ProfileSampler::sampleRange(uint64_t first, size_t npoints, const vector<double*> &positions, size_t shift, uint64_t key)
+{
+    unsigned int ndim = edges.size();
+    size_t ncells = probability.size();
+    vector<size_t> ncells_along(ndim);
+    for (unsigned int i=0; i<ndim; i++) ncells_along[i] = edges[i].size()-1;
+    for (size_t p=0; p<npoints; p++) {
+        uint64_t counter = (first + p) * (ndim + 1);
+        // cell: the integer part picks a column of the table, the fractional part chooses it or its alias
+        double x = uniform(mix(key + (++counter) * golden)) * ncells;
+        size_t c = min((size_t) x, ncells-1);
+        if (x - c >= probability[c]) c = alias[c];
+        // uniform position in the cell
+        for (int i=ndim-1; i>=0; i--) {
+            size_t j = c % ncells_along[i];
+            c /= ncells_along[i];
+            double u = uniform(mix(key + (++counter) * golden));
+            positions[i][shift+p] = edges[i][j] + u * (edges[i][j+1] - edges[i][j]);
+        }
+    }
+}
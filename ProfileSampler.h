@@ -0,0 +1,54 @@
+#ifndef ProfileSampler_H
+#define ProfileSampler_H
+
+#include <vector>
+#include <string>
+#include <stdint.h>
+#include "Profile.h"
+
+//  -------------------------------------------------------------------------------------------
+//! Random positions distributed like a density profile (e.g. to load particles).
+//! The profile is evaluated once at the centers of the cells of a rectilinear grid, in one
+//! Profile::valuesAtGrid (batched, tabulated or factorized like any grid), and the weights
+//! density * volume of the cells form an alias table: drawing a cell costs one random number
+//! whatever the number of cells, and the position is then uniform within the cell.
+//! Particle k of a draw with a given seed always gets the same position (counter-based random
+//! numbers), so that the positions do not depend on the number of threads.
+//  -------------------------------------------------------------------------------------------
+class ProfileSampler
+{
+public:
+    //! Cells between the successive edges along each variable of the profile
+    ProfileSampler(Profile &profile, std::vector<std::vector<double> > edges);
+    //! ncells[i] uniform cells between xmin[i] and xmax[i]
+    ProfileSampler(Profile &profile, std::vector<double> xmin, std::vector<double> xmax, std::vector<unsigned int> ncells);
+
+    //! Draws npoints positions (positions[i][p] is the coordinate i of point p), the particles
+    //! first, first+1, ... of the sequence given by seed, shared among nthreads threads (0 for all the cores)
+    void sample(size_t npoints, const std::vector<double*> &positions, uint64_t seed=0, unsigned int nthreads=1, uint64_t first=0);
+
+    //! Sum of the weights of the cells (integral of the profile with the midpoint rule)
+    inline double getTotalWeight() {
+        return total_weight;
+    };
+
+    //! Number of cells of the grid
+    inline size_t getNcells() {
+        return probability.size();
+    };
+
+private:
+    std::vector<std::vector<double> > edges;
+    double total_weight;
+
+    //! Alias table: cell c is kept with probability[c], otherwise the cell is alias[c]
+    std::vector<double> probability;
+    std::vector<size_t> alias;
+
+    void init(Profile &profile);
+
+    //! Particles first .. first+npoints-1 in positions (offset by shift)
+    void sampleRange(uint64_t first, size_t npoints, const std::vector<double*> &positions, size_t shift, uint64_t key);
+};
+
+#endif
@@ -23,12 +23,34 @@
 #include <sstream>
 #include <iostream>
 #include <fstream>
+#include <cstring>
+#include <algorithm>
+#include <map>
+#include <unordered_map>
+#include <mutex>
+#include <memory>
+#include <type_traits>
+#include <cerrno>
+#include <cstdlib>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <marshal.h>
+
+#include "pyprofiles.pyh"
+#include "NamelistSnapshot.h"
+#include "Instrumentation.h"
 
 #define ERROR(__txt) std::cout << "[ERROR] " << __FILE__ << ":" << __LINE__ << " (" << __FUNCTION__ << ") " << __txt << std::endl;
 
 
+template <typename T> class PyArrayView;
+
 //! tools to query python nemlist and get back C++ values and vectors
 class PyTools {
+public:
+    class ComponentView;
+    
 private:
     //! convert Python object to bool
     static bool pyconvert(PyObject* py_val, bool &val) {
@@ -82,12 +104,14 @@ private:
     
     //! check error and display message
     static double get_py_result(PyObject* pyresult) {
+        INSTRUMENT_PART(part_conversion);
+        // most profiles return floats
+        if (pyresult && PyFloat_CheckExact(pyresult)) return PyFloat_AS_DOUBLE(pyresult);
         checkPyError();
         double cppresult=0;
         if (pyresult) {
             if(!convert(pyresult,cppresult)) {
-                PyObject *ptype, *pvalue, *ptraceback;
-                PyErr_Fetch(&ptype, &pvalue, &ptraceback);
+                PyErr_Clear();
                 ERROR("function does not return float but " << pyresult->ob_type->tp_name);
             }
         } else {
@@ -97,16 +121,282 @@ private:
         return cppresult;
     }
 
+    //! storage of the numpy module (per thread, as each sub-interpreter has its own)
+    static PyObject*& numpyModule() {
+        static thread_local PyObject* np = NULL;
+        return np;
+    }
+    
+    //! name of the last namelist executed
+    static std::string& namelistFile() {
+        static std::string fname;
+        return fname;
+    }
+    
+    //! whole file in one buffer (no intermediate copy), false if it cannot be read.
+    //! With hash, the contents are hashed (see hashString, continuing from *hash) block by block as they are read.
+    static bool readFile(const std::string &fname, std::string &contents, uint64_t *hash=NULL) {
+        std::ifstream in(fname.c_str(), std::ios::binary | std::ios::ate);
+        if (!in.is_open()) return false;
+        std::streamoff size = in.tellg();
+        if (size < 0) return false;
+        contents.resize((size_t) size);
+        in.seekg(0);
+        if (!hash) return size == 0 || (bool) in.read(&contents[0], size);
+        const size_t block = 1<<16;
+        for (size_t start=0; start<contents.size(); start+=block) {
+            size_t n = std::min(block, contents.size()-start);
+            if (!in.read(&contents[start], n)) return false;
+            *hash = hashString(&contents[start], n, *hash);
+        }
+        return true;
+    }
+    
+    //! Code object of source compiled as the file fname, key being the hash of the file name and source
+    //! (see execFile). The marshalled code is kept in the cache directory, in a file named after key and
+    //! the python version; its header repeats key, the size of the source and the bytecode magic number,
+    //! which are checked on reload.
+    static PyObject* compileCached(const std::string &source, const std::string &fname, uint64_t key) {
+        std::string dir = cacheDirectory(), path;
+        uint64_t words[3] = { key, (uint64_t) source.size(), (uint64_t) PyImport_GetMagicNumber() };
+        std::string header((const char*) words, sizeof(words));
+        if (!dir.empty()) {
+            std::ostringstream p;
+            p << dir << "/namelist-" << std::hex << key << "-" << PY_VERSION_HEX << ".bin";
+            path = p.str();
+            std::string data;
+            if (readFile(path, data) && data.size() > header.size() && data.compare(0, header.size(), header) == 0) {
+                PyObject *code = PyMarshal_ReadObjectFromString(const_cast<char*>(data.data()) + header.size(), data.size() - header.size());
+                if (code && PyCode_Check(code)) return code;
+                Py_XDECREF(code);
+                PyErr_Clear();
+            }
+        }
+        PyObject *code = Py_CompileString(source.c_str(), fname.c_str(), Py_file_input);
+        if (code && !path.empty()) {
+            PyObject *bytes = PyMarshal_WriteObjectToString(code, Py_MARSHAL_VERSION);
+            if (bytes) {
+                writeFileAtomically(path, header, PyBytes_AS_STRING(bytes), PyBytes_GET_SIZE(bytes));
+                Py_DECREF(bytes);
+            } else {
+                PyErr_Clear();
+            }
+        }
+        return code;
+    }
+    
+    //! views of the component blocks of each interpreter, by name and number (e.g. "Species", 2) and by object
+    struct ComponentViews {
+        std::mutex mutex;
+        std::map<PyInterpreterState*, std::unordered_map<std::string, std::vector<ComponentView*> > > byName;
+        std::map<PyInterpreterState*, std::unordered_map<PyObject*, ComponentView*> > byObject;
+    };
+    static ComponentViews& componentViews() {
+        static ComponentViews views;
+        return views;
+    }
+
+    //! copy a python array (numpy, ...) of numbers into a vector
+    template <typename T>
+    static bool convertBuffer(PyObject* py_obj, std::vector<T> &val) {
+        PyArrayView<T> view;
+        return view.assign(py_obj) && view.copyTo(val);
+    }
+    static bool convertBuffer(PyObject*, std::vector<bool> &) {
+        return false;
+    }
+    static bool convertBuffer(PyObject*, std::vector<std::string> &) {
+        return false;
+    }
+
 public:
 
     static void openPython() {
-        if (!Py_IsInitialized())
+        if (!Py_IsInitialized()) {
             Py_Initialize();
+#if PY_VERSION_HEX < 0x03070000
+            PyEval_InitThreads();
+#endif
+            initInterpreter();
+        }
+    }
+    
+    //! holds the GIL during its lifetime, from any thread (does nothing if the thread already holds it)
+    class GILState {
+    public:
+        GILState() : state(PyGILState_Ensure()) {};
+        ~GILState() {
+            PyGILState_Release(state);
+        };
+    private:
+        PyGILState_STATE state;
+    };
+    
+    //! releases the GIL during its lifetime if the current thread holds it, so that other threads can use python
+    class GILRelease {
+    public:
+        GILRelease() : state(PyGILState_Check() ? PyEval_SaveThread() : NULL) {};
+        ~GILRelease() {
+            if (state) PyEval_RestoreThread(state);
+        };
+    private:
+        PyThreadState *state;
+    };
+    
+    //! Owning handle of a python object, released (with the GIL) when the handle is destroyed or reset.
+    //! PyRef(object) takes over a new reference (e.g. the result of a call), PyRef::borrow(object) adds one.
+    class PyRef {
+    public:
+        explicit PyRef(PyObject *object=NULL) : object(object) {};
+        static PyRef borrow(PyObject *object) {
+            Py_XINCREF(object);
+            return PyRef(object);
+        };
+        PyRef(const PyRef &other) : object(other.object) {
+            Py_XINCREF(object);
+        };
+        PyRef(PyRef &&other) : object(other.object) {
+            other.object = NULL;
+        };
+        PyRef & operator=(PyRef other) {
+            std::swap(object, other.object);
+            return *this;
+        };
+        ~PyRef() {
+            reset();
+        };
+        
+        //! releases the object and takes over the new reference object
+        void reset(PyObject *new_object=NULL) {
+            PyObject *old = object;
+            object = new_object;
+            if (old && Py_IsInitialized()) {
+                GILState gil;
+                Py_DECREF(old);
+            }
+        };
+        //! gives up the ownership (returns a new reference)
+        PyObject * release() {
+            PyObject *o = object;
+            object = NULL;
+            return o;
+        };
+        inline PyObject * get() const {
+            return object;
+        };
+        inline operator PyObject *() const {
+            return object;
+        };
+    private:
+        PyObject *object;
+    };
+    
+    //! definitions needed in each interpreter: python side of the native profiles (pyprofiles.py)
+    static void initInterpreter() {
+        PyRun_SimpleString(std::string((const char*)pyprofiles_py, pyprofiles_py_len).c_str());
+    }
+    
+    //! name of the last namelist executed by execFile
+    static std::string namelist() {
+        return namelistFile();
+    }
+    
+    //! 64-bit FNV-1a hash of data, continuing from hash
+    static uint64_t hashString(const std::string &data, uint64_t h=14695981039346656037ULL) {
+        return hashString(data.data(), data.size(), h);
+    }
+    static uint64_t hashString(const char * data, size_t size, uint64_t h=14695981039346656037ULL) {
+        for (size_t i=0; i<size; i++) {
+            h ^= (unsigned char) data[i];
+            h *= 1099511628211ULL;
+        }
+        return h;
+    }
+    
+    //! Write header then the size bytes of data to the file path. The file is written aside then renamed,
+    //! so that other processes only see complete files. Returns false on error (path is then unchanged).
+    static bool writeFileAtomically(const std::string &path, const std::string &header, const char * data, size_t size) {
+        std::string tmp = path + "." + std::to_string(getpid()) + ".tmp";
+        std::ofstream out(tmp.c_str(), std::ios::binary);
+        out.write(header.data(), header.size());
+        out.write(data, size);
+        out.close();
+        if (out && rename(tmp.c_str(), path.c_str()) == 0) return true;
+        remove(tmp.c_str());
+        return false;
+    }
+    
+    //! Directory of the caches (e.g. compiled namelists), created if needed: $NICO_CACHE_DIR,
+    //! or $XDG_CACHE_HOME/nico, or ~/.cache/nico. Empty (no cache) when NICO_CACHE_DIR is set
+    //! to an empty string or when the directory cannot be created.
+    static std::string cacheDirectory() {
+        const char *env = getenv("NICO_CACHE_DIR");
+        std::string dir;
+        if (env) {
+            dir = env;
+        } else if ((env = getenv("XDG_CACHE_HOME")) && *env) {
+            dir = std::string(env) + "/nico";
+        } else if ((env = getenv("HOME")) && *env) {
+            dir = std::string(env) + "/.cache/nico";
+        }
+        // mkdir -p
+        for (size_t slash=dir.find('/', 1); !dir.empty(); slash=dir.find('/', slash+1)) {
+            std::string parent = dir.substr(0, slash);
+            if (mkdir(parent.c_str(), 0755) != 0 && errno != EEXIST) return "";
+            if (slash == std::string::npos) break;
+        }
+        struct stat st;
+        if (dir.empty() || stat(dir.c_str(), &st) != 0 || !S_ISDIR(st.st_mode)) return "";
+        return dir;
     }
     
     static void closePython() {
-        if (Py_IsInitialized())
+        if (Py_IsInitialized()) {
+            Py_CLEAR(numpyModule());
+            clearComponents();
+            INSTRUMENT_REPORT(std::cout);
             Py_Finalize();
+        }
+    }
+    
+    //! numpy module (imported once), NULL if numpy is not available
+    static PyObject* numpy() {
+        static thread_local bool tried = false;
+        if (!numpyModule() && !tried) {
+            tried = true;
+            numpyModule() = PyImport_ImportModule("numpy");
+            if (!numpyModule()) PyErr_Clear();
+        }
+        return numpyModule();
+    }
+    
+    //! number of arguments of a python function, -1 if unknown
+    //! (getargspec was removed in python 3.11, getfullargspec is absent in python 2)
+    static int nArguments(PyObject *function) {
+        PyObject* inspect=PyImport_ImportModule("inspect");
+        checkPyError();
+        if (!inspect) return -1;
+        const char* argspec = PyObject_HasAttrString(inspect, "getfullargspec") ? "getfullargspec" : "getargspec";
+        PyObject *tuple = PyObject_CallMethod(inspect,const_cast<char *>(argspec),const_cast<char *>("(O)"),function);
+        checkPyError();
+        int size = -1;
+        if (tuple) {
+            PyObject *arglist = PyTuple_GetItem(tuple,0);
+            size = PyObject_Size(arglist);
+        }
+        Py_XDECREF(tuple);
+        Py_XDECREF(inspect);
+        return size;
+    }
+    
+    //! Number of memory blocks allocated by python (-1 if unknown): it grows when references leak,
+    //! as the objects they hold are never freed (see `bench/bench --leak-check`)
+    static long allocatedBlocks() {
+        GILState gil;
+        PyRef blocks(PyObject_CallMethod(PyImport_AddModule("sys"), const_cast<char*>("getallocatedblocks"), NULL));
+        long n = blocks ? PyLong_AsLong(blocks) : -1;
+        PyErr_Clear();
+        return n;
     }
     
     static std::string python_version()
@@ -121,20 +411,51 @@ public:
         return version;
     }
     
-    static void execFile(std::string fname) {
+    //! Forget the component views of the current interpreter (the namelist may have changed)
+    static void clearComponents() {
+        ComponentViews &views = componentViews();
+        PyInterpreterState *interp = PyThreadState_Get()->interp;
+        std::unordered_map<std::string, std::vector<ComponentView*> > byName;
+        {
+            std::lock_guard<std::mutex> lock(views.mutex);
+            byName.swap(views.byName[interp]);
+            views.byName.erase(interp);
+            views.byObject.erase(interp);
+        }
+        for (std::unordered_map<std::string, std::vector<ComponentView*> >::iterator it=byName.begin(); it!=byName.end(); it++) {
+            for (unsigned int i=0; i<it->second.size(); i++) delete it->second[i];
+        }
+    }
+    
+    //! execute a namelist file, returns false on error
+    //! (the compiled namelist is kept in the cache directory for the next runs, see compileCached)
+    static bool execFile(std::string fname) {
 
         if (!Py_IsInitialized()) ERROR("Python not initialized: this should not happen");
+        clearComponents();
 
-		std::ifstream istr(fname);
-		if (!istr.is_open()) {
+		bool success = false;
+		std::string source;
+		// the source is hashed while it is read, and compiled as read (python accepts a last line without newline)
+		uint64_t key = hashString(fname + std::string(1, '\0'));
+		if (!readFile(fname, source, &key)) {
 			std::cerr << "Error need a file to parse" << std::endl;
 		} else {
-	
-			std::stringstream buffer;
-			buffer << istr.rdbuf() << "\n";
+			namelistFile() = fname;
 		
-			PyRun_SimpleString(buffer.str().c_str());
+			// compiled with the file name, so that the source of the functions can be inspected
+			PyObject *code = compileCached(source, fname, key);
+			source.clear();
+			if (code) {
+				PyObject *globals = PyModule_GetDict(PyImport_AddModule("__main__"));
+				PyObject *result = PyEval_EvalCode(code, globals, globals);
+				success = (result != NULL);
+				Py_XDECREF(result);
+				Py_DECREF(code);
+			}
+			if (PyErr_Occurred()) PyErr_Print();
 		}
+		return success;
     }
 
     //! convert Python object to C++ value
@@ -144,6 +465,60 @@ public:
         return retval;
     }
     
+    //! convert Python array-like (or scalar, broadcast) of npoints floats into a C++ buffer;
+    //! with several components, array-like of shape (ncomponents, npoints), or of ncomponents values broadcast
+    //! (val[c*npoints + p] is the component c at point p)
+    static bool convert(PyObject* py_val, unsigned int npoints, double * val, unsigned int ncomponents=1) {
+        PyObject *np = numpy();
+        if (!np || !py_val) return false;
+        // tuple or list of components, each an array or a number (e.g. `return (x, y, 0.)`)
+        if (ncomponents > 1 && (PyTuple_Check(py_val) || PyList_Check(py_val))) {
+            if (PySequence_Size(py_val) != (Py_ssize_t)ncomponents) return false;
+            bool success = true;
+            for (unsigned int c=0; c<ncomponents && success; c++) {
+                PyObject *item = PySequence_GetItem(py_val, c);
+                success = convert(item, npoints, val+c*npoints);
+                Py_XDECREF(item);
+            }
+            return success;
+        }
+        PyObject *arr = PyObject_CallMethod(np, const_cast<char *>("ascontiguousarray"), const_cast<char *>("(Os)"), py_val, "float64");
+        if (!arr) {
+            PyErr_Clear();
+            return false;
+        }
+        bool success = false;
+        Py_buffer view;
+        if (PyObject_GetBuffer(arr, &view, PyBUF_C_CONTIGUOUS | PyBUF_FORMAT) == 0) {
+            Py_ssize_t n = view.len / sizeof(double);
+            if (n == (Py_ssize_t)npoints*ncomponents) {
+                memcpy(val, view.buf, npoints*ncomponents*sizeof(double));
+                success = true;
+            } else if (n == (Py_ssize_t)ncomponents) {
+                for (unsigned int c=0; c<ncomponents; c++) std::fill(val+c*npoints, val+(c+1)*npoints, ((double*)view.buf)[c]);
+                success = true;
+            }
+            PyBuffer_Release(&view);
+        }
+        Py_DECREF(arr);
+        PyErr_Clear();
+        return success;
+    }
+    
+    //! convert a tuple, list or array of ncomponents numbers, val[c*stride] being the component c
+    static bool convertComponents(PyObject* py_val, unsigned int ncomponents, double * val, size_t stride=1) {
+        PyObject* seq = py_val ? PySequence_Fast(py_val, "expected a sequence") : NULL;
+        if (!seq) return false;
+        bool success = (PySequence_Fast_GET_SIZE(seq) == (Py_ssize_t)ncomponents);
+        for (unsigned int c=0; c<ncomponents && success; c++) {
+            PyObject* item = PySequence_Fast_GET_ITEM(seq, c);
+            if (PyFloat_Check(item)) val[c*stride] = PyFloat_AS_DOUBLE(item);
+            else success = pyconvert(item, val[c*stride]);
+        }
+        Py_DECREF(seq);
+        return success;
+    }
+    
     //! convert vector of Python objects to vector of C++ values
     template <typename T>
     static bool convert(std::vector<PyObject*> py_vec, std::vector<T> &val) {
@@ -189,13 +564,12 @@ public:
             PyErr_Fetch(&type, &value, &traceback);
             PyErr_Clear();
             
-            std::string message("");
+            std::string message(""), type_name("");
             if (type) {
-                std::string str("");
                 PyObject * tn = PyObject_GetAttrString(type, "__name__");
-                pyconvert(tn, str);
+                pyconvert(tn, type_name);
                 Py_XDECREF(tn);
-                message += str;
+                message += type_name;
             }
             if (value) {
                 message += ": ";
@@ -206,17 +580,18 @@ public:
             Py_XDECREF(traceback);
             if (exitOnError) {
                 ERROR(message);
+            } else {
+                INSTRUMENT_EXCEPTION(type_name, message);
             }
         }
     }
     
     //! run void python function
     static void runPyFunction(std::string name) {
-        PyObject* myFunction = PyObject_GetAttrString(PyImport_AddModule("__main__"),name.c_str());
+        PyRef myFunction(PyObject_GetAttrString(PyImport_AddModule("__main__"),name.c_str()));
         if (myFunction) {
-            PyObject_CallFunction(myFunction,const_cast<char *>(""));
+            PyRef result(PyObject_CallFunction(myFunction,const_cast<char *>("")));
             checkPyError(true);
-            Py_DECREF(myFunction);
         } else {
             ERROR("python " << name << " function does not exists");
         }
@@ -226,25 +601,442 @@ public:
     template <typename T=double>
     static T runPyFunction(std::string name, std::string component=std::string("")) {
         T retval(0);
-        PyObject *py_obj=PyImport_AddModule("__main__");
+        PyRef py_obj = PyRef::borrow(PyImport_AddModule("__main__"));
         if (!component.empty()) {
-            py_obj = PyObject_GetAttrString(py_obj,component.c_str());
+            py_obj.reset(PyObject_GetAttrString(py_obj,component.c_str()));
             PyTools::checkPyError();
+            if (!py_obj) return retval;
         }
-        PyObject* myFunction = PyObject_GetAttrString(py_obj,name.c_str());
+        PyRef myFunction(PyObject_GetAttrString(py_obj,name.c_str()));
         if (myFunction) {
-            PyObject *pyresult = PyObject_CallFunction(myFunction, const_cast<char *>(""));
+            PyRef pyresult(PyObject_CallFunction(myFunction, const_cast<char *>("")));
             retval = (T) get_py_result(pyresult);
-            Py_DECREF(myFunction);
-            Py_XDECREF(pyresult);
         }
+        PyErr_Clear();
+        return retval;
+    }
+    
+    //! run typed python function of the namelist with the given arguments (e.g. PyArrayExport::view)
+    template <typename T=double>
+    static T runPyFunction(std::string name, const std::vector<PyObject*> &arguments) {
+        T retval(0);
+        PyRef myFunction(PyObject_GetAttrString(PyImport_AddModule("__main__"), name.c_str()));
+        if (!myFunction) {
+            PyErr_Clear();
+            ERROR("python " << name << " function does not exists");
+            return retval;
+        }
+        PyRef args(PyTuple_New(arguments.size()));
+        for (unsigned int i=0; i<arguments.size(); i++) {
+            Py_INCREF(arguments[i]);
+            PyTuple_SET_ITEM(args.get(), i, arguments[i]);
+        }
+        PyRef pyresult(PyObject_Call(myFunction, args, NULL));
+        retval = (T) get_py_result(pyresult);
         return retval;
     }
     
+    //! call a python function with the arguments args[0 .. nargs-1] (new reference, NULL on error);
+    //! args[-1] must exist: python may use it temporarily (vectorcall protocol)
+    static PyObject* vectorcall(PyObject *pyFunction, PyObject **args, unsigned int nargs) {
+#if PY_VERSION_HEX >= 0x03090000
+        return PyObject_Vectorcall(pyFunction, args, nargs | PY_VECTORCALL_ARGUMENTS_OFFSET, NULL);
+#elif PY_VERSION_HEX >= 0x03080000
+        return _PyObject_Vectorcall(pyFunction, args, nargs | PY_VECTORCALL_ARGUMENTS_OFFSET, NULL);
+#else
+        PyObject *tuple = PyTuple_New(nargs);
+        for (unsigned int i=0; i<nargs; i++) {
+            Py_INCREF(args[i]);
+            PyTuple_SET_ITEM(tuple, i, args[i]);
+        }
+        PyObject *pyresult = PyObject_Call(pyFunction, tuple, NULL);
+        Py_DECREF(tuple);
+        return pyresult;
+#endif
+    }
+    
+    //! call a python function with at most 4 float arguments (new reference, NULL on error)
+    static PyObject* callFunction(PyObject *pyFunction, const double * x, unsigned int nargs) {
+        PyObject *args[5] = {NULL, NULL, NULL, NULL, NULL};
+        for (unsigned int i=0; i<nargs; i++) args[i+1] = PyFloat_FromDouble(x[i]);
+        PyObject *pyresult = vectorcall(pyFunction, args+1, nargs);
+        for (unsigned int i=0; i<nargs; i++) Py_DECREF(args[i+1]);
+        return pyresult;
+    }
+    
+    //! Python function of floats called many times (profiles): the arguments are passed without tuple
+    //! (vectorcall, new floats taken from the free list of CPython: floats are immutable and python may keep
+    //! them), float and int results are read directly, and the errors are only reported by checkErrors
+    //! (e.g. once per batch of points).
+    //! The GIL must be held when calling it.
+    class FastCall {
+    public:
+        FastCall(PyObject *f, unsigned int n) : function(f), nargs(n), errors(0),
+            error_type(NULL), error_value(NULL), error_traceback(NULL)
+        {
+        };
+        ~FastCall() {
+            if (Py_IsInitialized()) {
+                GILState gil;
+                Py_XDECREF(error_type);
+                Py_XDECREF(error_value);
+                Py_XDECREF(error_traceback);
+            }
+        };
+        
+        //! value at x (x[0] .. x[nargs-1]); 0 if python raised an error
+        inline double operator()(const double * x) {
+            return result(object(x));
+        };
+        
+        //! python result at x (new reference), NULL with the python error set if it raised one
+        inline PyObject * object(const double * x) {
+            INSTRUMENT_PART(part_interpreter);
+            return callFunction(function, x, nargs);
+        };
+        
+        //! Displays the first python error since the last check (returns the number of errors)
+        unsigned int checkErrors() {
+            unsigned int n = errors;
+            if (errors) {
+                PyErr_Restore(error_type, error_value, error_traceback);
+                error_type = error_value = error_traceback = NULL;
+                errors = 0;
+                checkPyError(true);
+                if (n > 1) ERROR("(" << n << " errors in the same batch of calls)");
+            }
+            return n;
+        };
+        
+        //! keeps the current python error until checkErrors, so that python can be called again
+        //! (only the first error since the last check is kept)
+        void error() {
+            if (errors++ == 0) {
+                PyErr_Fetch(&error_type, &error_value, &error_traceback);
+            } else {
+                PyErr_Clear();
+            }
+        };
+        
+    private:
+        inline double result(PyObject *pyresult) {
+            INSTRUMENT_PART(part_conversion);
+            double value = 0.;
+            if (!pyresult) {
+                error();
+                return 0.;
+            } else if (PyFloat_CheckExact(pyresult)) {
+                value = PyFloat_AS_DOUBLE(pyresult);
+#if PY_MAJOR_VERSION >= 3
+            } else if (PyLong_CheckExact(pyresult)) {
+                value = PyLong_AsDouble(pyresult);
+                if (value == -1. && PyErr_Occurred()) {
+                    error();
+                    value = 0.;
+                }
+#endif
+            } else if (!convert(pyresult, value)) {
+                ERROR("function does not return float but " << pyresult->ob_type->tp_name);
+                PyErr_Clear();
+            }
+            Py_DECREF(pyresult);
+            return value;
+        };
+        
+        PyObject *function;
+        unsigned int nargs;
+        unsigned int errors;
+        PyObject *error_type, *error_value, *error_traceback;
+        
+        FastCall(const FastCall &);
+        FastCall & operator=(const FastCall &);
+    };
+    
+    //! Attributes of one component block (e.g. Species[2]), or of the namelist itself, resolved once:
+    //! the attributes of its dictionary are indexed with their numbers and strings already converted,
+    //! the other ones (e.g. class attributes) the first time they are asked for.
+    //! The GIL must be held when using it.
+    class ComponentView {
+    public:
+        //! the view keeps the reference to block
+        ComponentView(PyObject *b) : block(b) {
+            INSTRUMENT_PART(part_conversion);
+            PyObject *dict = PyModule_Check(block) ? PyModule_GetDict(block) : NULL, *owned = NULL;
+            if (!dict) {
+                dict = owned = PyObject_GetAttrString(block, "__dict__");
+                if (!owned) PyErr_Clear();
+            }
+            if (dict && PyDict_Check(dict)) {
+                Py_ssize_t pos = 0;
+                PyObject *key, *value;
+                std::string name;
+                while (PyDict_Next(dict, &pos, &key, &value)) {
+                    if (pyconvert(key, name)) index(name, value);
+                }
+            }
+            Py_XDECREF(owned);
+        };
+        ~ComponentView() {
+            if (Py_IsInitialized()) {
+                for (std::unordered_map<std::string, Value>::iterator it=values.begin(); it!=values.end(); it++) {
+                    Py_XDECREF(it->second.object);
+                }
+                Py_DECREF(block);
+            }
+        };
+        
+        inline PyObject * getBlock() {
+            return block;
+        };
+        
+        //! attribute (borrowed reference), NULL if absent
+        inline PyObject * object(const std::string &name) {
+            return find(name).object;
+        };
+        
+        //! attribute converted to C++ (false if absent or not convertible)
+        bool get(const std::string &name, double &value) {
+            Value &v = find(name);
+            if (v.kind == kind_number || v.kind == kind_integer) {
+                value = v.number;
+                return true;
+            }
+            return convert(v.object, value);
+        };
+        bool get(const std::string &name, bool &value) {
+            Value &v = find(name);
+            if (v.kind == kind_number || v.kind == kind_integer) {
+                value = (v.number != 0.);
+                return true;
+            }
+            return convert(v.object, value);
+        };
+        bool get(const std::string &name, std::string &value) {
+            Value &v = find(name);
+            if (v.kind == kind_string) {
+                value = v.text;
+                return true;
+            }
+            return convert(v.object, value);
+        };
+        //! integers (int, unsigned int, ...)
+        template <typename T>
+        bool get(const std::string &name, T &value) {
+            Value &v = find(name);
+            if (v.kind == kind_integer) {
+                value = (T) v.integer;
+                return true;
+            } else if (v.kind == kind_number) {
+                value = (T) (long long) v.number;
+                return true;
+            }
+            return convert(v.object, value);
+        };
+        //! lists of python objects (borrowed references) or of strings
+        bool get(const std::string &name, std::vector<PyObject*> &values) {
+            return convert(find(name).object, values);
+        };
+        bool get(const std::string &name, std::vector<std::string> &values) {
+            return convert(find(name).object, values);
+        };
+        //! lists of numbers (converted the first time), false for other objects
+        template <typename T>
+        bool get(const std::string &name, std::vector<T> &values) {
+            Value &v = find(name);
+            if (v.kind != kind_list) return false;
+            if (!v.converted) {
+                INSTRUMENT_PART(part_conversion);
+                v.converted = true;
+                Py_ssize_t n = PyList_GET_SIZE(v.object);
+                v.numbers.resize(n);
+                for (Py_ssize_t i=0; i<n; i++) {
+                    PyObject *item = PyList_GET_ITEM(v.object, i);
+                    if (PyFloat_Check(item)) {
+                        v.numbers[i] = PyFloat_AS_DOUBLE(item);
+                    } else if (PyLong_Check(item)) {
+                        v.numbers[i] = PyLong_AsDouble(item);
+                    } else {
+                        v.numbers.clear();
+                        v.kind = kind_object;
+                        return false;
+                    }
+                }
+            }
+            values.assign(v.numbers.begin(), v.numbers.end());
+            return true;
+        };
+        
+    private:
+        enum Kind { kind_object, kind_number, kind_integer, kind_string, kind_list };
+        
+        struct Value {
+            Value() : object(NULL), kind(kind_object), number(0.), integer(0), converted(false) {};
+            PyObject *object;
+            Kind kind;
+            double number;
+            long long integer;
+            std::string text;
+            //! lists: numbers, converted the first time they are asked for
+            bool converted;
+            std::vector<double> numbers;
+        };
+        
+        Value & index(const std::string &name, PyObject *object) {
+            Value &v = values[name];
+            Py_XINCREF(object);
+            Py_XDECREF(v.object);
+            v = Value();
+            v.object = object;
+            if (!object) {
+            } else if (PyFloat_Check(object)) {
+                v.kind = kind_number;
+                v.number = PyFloat_AS_DOUBLE(object);
+            } else if (PyLong_Check(object)) {
+                v.integer = PyLong_AsLongLong(object);
+                if (v.integer == -1 && PyErr_Occurred()) {
+                    PyErr_Clear();
+                } else {
+                    v.kind = kind_integer;
+                    v.number = (double) v.integer;
+                }
+            } else if (PyUnicode_Check(object)) {
+                if (pyconvert(object, v.text)) v.kind = kind_string;
+            } else if (PyList_Check(object)) {
+                v.kind = kind_list;
+            }
+            return v;
+        };
+        
+        //! attribute, looked up in the block the first time when it is not in its dictionary
+        Value & find(const std::string &name) {
+            std::unordered_map<std::string, Value>::iterator it = values.find(name);
+            if (it != values.end()) return it->second;
+            INSTRUMENT_PART(part_interpreter);
+            PyObject *object = PyObject_GetAttrString(block, name.c_str());
+            checkPyError();
+            Value &v = index(name, object);
+            Py_XDECREF(object);
+            return v;
+        };
+        
+        PyObject *block;
+        std::unordered_map<std::string, Value> values;
+        
+        ComponentView(const ComponentView &);
+        ComponentView & operator=(const ComponentView &);
+    };
+    
+    //! View of the component block nComponent of component (e.g. Species #2), or of the namelist
+    //! when component is empty, created the first time (NULL if it does not exist)
+    static ComponentView * componentView(const std::string &component=std::string(""), int nComponent=0) {
+        ComponentViews &views = componentViews();
+        PyInterpreterState *interp = PyThreadState_Get()->interp;
+        if (nComponent < 0) nComponent = 0;
+        {
+            std::lock_guard<std::mutex> lock(views.mutex);
+            std::vector<ComponentView*> &blocks = views.byName[interp][component];
+            if ((size_t)nComponent < blocks.size() && blocks[nComponent]) return blocks[nComponent];
+        }
+        INSTRUMENT_PART(part_interpreter);
+        PyObject *block = PyImport_AddModule("__main__");
+        if (component.empty()) {
+            Py_XINCREF(block);
+        } else {
+            // Get the selected component (e.g. "Species" or "Laser")
+            PyObject *list = PyObject_GetAttrString(block, component.c_str());
+            PyTools::checkPyError();
+            if (!list) {
+                ERROR("Component "<<component<<" not found in namelist");
+                return NULL;
+            }
+            int len = PyObject_Length(list);
+            if (len > nComponent) {
+                block = PySequence_GetItem(list, nComponent);
+                PyTools::checkPyError();
+            } else {
+                ERROR("Requested " << component << " #" <<nComponent<< ", but only "<<len<<" available");
+                block = NULL;
+            }
+            Py_DECREF(list);
+        }
+        if (!block) return NULL;
+        ComponentView *view = new ComponentView(block);
+        std::lock_guard<std::mutex> lock(views.mutex);
+        std::vector<ComponentView*> &blocks = views.byName[interp][component];
+        if ((size_t)nComponent >= blocks.size()) blocks.resize(nComponent+1, NULL);
+        blocks[nComponent] = view;
+        views.byObject[interp][block] = view;
+        return view;
+    }
+    
+    //! View of a component block given by its object (NULL if it has none)
+    static ComponentView * componentView(PyObject *block) {
+        ComponentViews &views = componentViews();
+        std::lock_guard<std::mutex> lock(views.mutex);
+        std::unordered_map<PyObject*, ComponentView*> &byObject = views.byObject[PyThreadState_Get()->interp];
+        std::unordered_map<PyObject*, ComponentView*>::iterator it = byObject.find(block);
+        return it == byObject.end() ? NULL : it->second;
+    }
+    
+    //! View holding the attribute name of the component block (NULL if it does not exist)
+    static ComponentView * componentOf(const std::string &name, const std::string &component, int nComponent) {
+        if (name.find(" ")!= std::string::npos || component.find(" ")!= std::string::npos) {
+            ERROR("asking for [" << name << "] [" << component << "] : it has whitespace inside: please fix the code");
+        }
+        if (NamelistSnapshot::replaying()) {
+            ERROR("asking for python object [" << name << "] [" << component << "] while replaying a namelist snapshot");
+            return NULL;
+        }
+        if (!Py_IsInitialized()) ERROR("Python not initialized: this should not happen");
+        return componentView(component, nComponent);
+    }
+    
+    //! run python function on whole arrays of coordinates at once (x[i][p] is argument i of point p)
+    //! returns false (without error) if numpy is missing or the function is not vectorizable
+    //! (with several components, result[c*npoints + p] is the component c at point p)
+    static bool runPyFunction(PyObject *pyFunction, const std::vector<double*> &x, unsigned int npoints, double * result,
+                              unsigned int ncomponents=1) {
+#if PY_MAJOR_VERSION >= 3
+        PyObject *np = numpy();
+        if (!np) return false;
+        PyObject *args = PyTuple_New(x.size());
+        for (unsigned int i=0; i<x.size(); i++) {
+            // numpy array sharing the memory of the C++ coordinates (no copy)
+            PyObject *mv = PyMemoryView_FromMemory((char*)x[i], npoints*sizeof(double), PyBUF_READ);
+            PyObject *arr = mv ? PyObject_CallMethod(np, const_cast<char *>("frombuffer"), const_cast<char *>("(O)"), mv) : NULL;
+            Py_XDECREF(mv);
+            if (!arr) {
+                Py_DECREF(args);
+                PyErr_Clear();
+                return false;
+            }
+            PyTuple_SET_ITEM(args, i, arr);
+        }
+        PyObject *pyresult;
+        {
+            INSTRUMENT_PART(part_interpreter);
+            pyresult = PyObject_CallObject(pyFunction, args);
+        }
+        Py_DECREF(args);
+        INSTRUMENT_PART(part_conversion);
+        bool success = pyresult && convert(pyresult, npoints, result, ncomponents);
+        Py_XDECREF(pyresult);
+        PyErr_Clear();
+        return success;
+#else
+        return false;
+#endif
+    }
+    
     //! run typed python function with one argument
     template <typename T=double>
     static T runPyFunction(PyObject *pyFunction, double x1) {
-        PyObject *pyresult = PyObject_CallFunction(pyFunction, const_cast<char *>("d"), x1);
+        PyObject *pyresult;
+        {
+            INSTRUMENT_PART(part_interpreter);
+            double x[1] = {x1};
+            pyresult = callFunction(pyFunction, x, 1);
+        }
         T retval = (T) get_py_result(pyresult);
         Py_XDECREF(pyresult);
         return retval;
@@ -253,7 +1045,12 @@ public:
     //! run typed python function with two arguments
     template <typename T=double>
     static T runPyFunction(PyObject *pyFunction, double x1, double x2) {
-        PyObject *pyresult = PyObject_CallFunction(pyFunction, const_cast<char *>("dd"), x1, x2);
+        PyObject *pyresult;
+        {
+            INSTRUMENT_PART(part_interpreter);
+            double x[2] = {x1, x2};
+            pyresult = callFunction(pyFunction, x, 2);
+        }
         T retval = (T) get_py_result(pyresult);
         Py_XDECREF(pyresult);
         return retval;
@@ -262,7 +1059,12 @@ public:
     //! run typed python function with three arguments
     template <typename T=double>
     static T runPyFunction(PyObject *pyFunction, double x1, double x2, double x3) {
-        PyObject *pyresult = PyObject_CallFunction(pyFunction, const_cast<char *>("ddd"), x1, x2, x3);
+        PyObject *pyresult;
+        {
+            INSTRUMENT_PART(part_interpreter);
+            double x[3] = {x1, x2, x3};
+            pyresult = callFunction(pyFunction, x, 3);
+        }
         T retval = (T) get_py_result(pyresult);
         Py_XDECREF(pyresult);
         return retval;
@@ -271,7 +1073,12 @@ public:
     //! run typed python function with four arguments
     template <typename T=double>
     static T runPyFunction(PyObject *pyFunction, double x1, double x2, double x3, double x4) {
-        PyObject *pyresult = PyObject_CallFunction(pyFunction, const_cast<char *>("dddd"), x1, x2, x3, x4);
+        PyObject *pyresult;
+        {
+            INSTRUMENT_PART(part_interpreter);
+            double x[4] = {x1, x2, x3, x4};
+            pyresult = callFunction(pyFunction, x, 4);
+        }
         T retval = (T) get_py_result(pyresult);
         Py_XDECREF(pyresult);
         return retval;
@@ -280,54 +1087,77 @@ public:
     //! get T from python
     template< typename T>
     static bool extract(std::string name, T &val, std::string component=std::string(""), int nComponent=0) {
-        PyObject* py_val = extract_py(name,component,nComponent);
-        PyTools::checkPyError();
-        if (PyList_Check(py_val)) {
+        INSTRUMENT_CALL("extract " + NamelistSnapshot::key(name,component,nComponent));
+        if (NamelistSnapshot::replaying()) {
+            return NamelistSnapshot::get(NamelistSnapshot::key(name,component,nComponent), val);
+        }
+        ComponentView *view = componentOf(name,component,nComponent);
+        if (!view) return false;
+        PyObject* py_val = view->object(name);
+        if (py_val && PyList_Check(py_val)) {
             ERROR("Looking for single value \"" << name << "\" in " << component << " #" << nComponent << " but got a list.");
         }
-        return PyTools::convert(py_val,val);
+        bool success;
+        {
+            INSTRUMENT_PART(part_conversion);
+            success = view->get(name,val);
+        }
+        if (success && NamelistSnapshot::recording()) {
+            NamelistSnapshot::put(NamelistSnapshot::key(name,component,nComponent), val);
+        }
+        return success;
     }
     
     //! extract vectors
     template< typename T>
     static bool extract(std::string name, std::vector<T> &val, std::string component=std::string(""), int nComponent=0) {
-        std::vector<PyObject*> py_val = extract_pyVec(name,component,nComponent);
-        if (py_val.size())
-            return PyTools::convert(py_val,val);
-        return false;
+        INSTRUMENT_CALL("extract " + NamelistSnapshot::key(name,component,nComponent));
+        if (NamelistSnapshot::replaying()) {
+            return NamelistSnapshot::get(NamelistSnapshot::key(name,component,nComponent), val);
+        }
+        ComponentView *view = componentOf(name,component,nComponent);
+        if (!view) return false;
+        // lists of numbers are converted once, arrays (numpy, ...) are copied in bulk
+        bool success = view->get(name, val);
+        PyObject* py_obj = view->object(name);
+        if (success) {
+        } else if (py_obj && !PyList_Check(py_obj) && PyObject_CheckBuffer(py_obj)) {
+            INSTRUMENT_PART(part_conversion);
+            success = convertBuffer(py_obj, val);
+        } else {
+            std::vector<PyObject*> py_val = extract_pyVec(name,component,nComponent);
+            INSTRUMENT_PART(part_conversion);
+            if (py_val.size())
+                success = PyTools::convert(py_val,val);
+        }
+        if (success && NamelistSnapshot::recording()) {
+            NamelistSnapshot::put(NamelistSnapshot::key(name,component,nComponent), val);
+        }
+        return success;
     }
     
-    //! retrieve python object
+    //! extract an array of any dimension (numpy array, buffer, or nested lists), without copy when possible
+    template< typename T>
+    static bool extract(std::string name, PyArrayView<T> &view, std::string component=std::string(""), int nComponent=0) {
+        INSTRUMENT_CALL("extract " + NamelistSnapshot::key(name,component,nComponent));
+        ComponentView *block = componentOf(name,component,nComponent);
+        INSTRUMENT_PART(part_conversion);
+        return view.assign(block ? block->object(name) : NULL);
+    }
+    
+    //! retrieve python object (new reference)
     static PyObject* extract_py(std::string name, std::string component=std::string(""), int nComponent=0) {
-        if (name.find(" ")!= std::string::npos || component.find(" ")!= std::string::npos) {
-            ERROR("asking for [" << name << "] [" << component << "] : it has whitespace inside: please fix the code");
-        }
-        if (!Py_IsInitialized()) ERROR("Python not initialized: this should not happen");
-        PyObject *py_obj=PyImport_AddModule("__main__");
-        // If component requested
-        if (!component.empty()) {
-            // Get the selected component (e.g. "Species" or "Laser")
-            py_obj = PyObject_GetAttrString(py_obj,component.c_str());
-            PyTools::checkPyError();
-            // Error if not found
-            if (!py_obj) ERROR("Component "<<component<<" not found in namelist");
-            // If successfully found
-            int len = PyObject_Length(py_obj);
-            if (len > nComponent) {
-                py_obj = PySequence_GetItem(py_obj, nComponent);
-            } else {
-                ERROR("Requested " << component << " #" <<nComponent<< ", but only "<<len<<" available");
-            }
-        }
-        PyObject *py_return=PyObject_GetAttrString(py_obj,name.c_str());
-        PyTools::checkPyError();
+        ComponentView *view = componentOf(name,component,nComponent);
+        PyObject *py_return = view ? view->object(name) : NULL;
+        Py_XINCREF(py_return);
         return py_return;
     }
     
-    //! retrieve a vector of python objects
+    //! retrieve a vector of python objects (borrowed references, held by the component view)
     static std::vector<PyObject*> extract_pyVec(std::string name, std::string component=std::string(""), int nComponent=0) {
         std::vector<PyObject*> retvec;
-        PyObject* py_obj = extract_py(name,component,nComponent);
+        ComponentView *view = componentOf(name,component,nComponent);
+        PyObject* py_obj = view ? view->object(name) : NULL;
         if( ! convert(py_obj, retvec) ) {
             std::ostringstream ss("");
             if (component!="") {
@@ -338,16 +1168,19 @@ public:
         return retvec;
     }
     
+    //! retrieve a python function (new reference)
     static bool extract_pyProfile(std::string name, PyObject*& myPy, std::string component=std::string(""), int nComponent=0) {
+        INSTRUMENT_CALL("extract " + NamelistSnapshot::key(name,component,nComponent));
         PyObject* myPytmp=extract_py(name,component,nComponent);
-        if (PyCallable_Check(myPytmp)) {
+        if (myPytmp && PyCallable_Check(myPytmp)) {
             myPy=myPytmp;
             return true;
         }
+        Py_XDECREF(myPytmp);
         return false;
     }
     
-    // extract 3 profiles from namelist (used for part mean velocity and temperature)
+    // extract 3 profiles from namelist (used for part mean velocity and temperature), new references
     static void extract3Profiles(std::string varname, int ispec, PyObject*& profx, PyObject*& profy, PyObject*& profz )
     {
         std::vector<PyObject*> pvec = PyTools::extract_pyVec(varname,"Species",ispec);
@@ -363,13 +1196,18 @@ public:
             profz = pvec[2];
         } else {
             ERROR("For species #" << ispec << ", "<<varname<<" needs 1 or 3 components.");
+            return;
         }
+        Py_INCREF(profx);
+        Py_INCREF(profy);
+        Py_INCREF(profz);
     }
     
-    // extract 2 profiles from namelist (used for laser profile)
+    // extract 2 profiles from namelist (used for laser profile), new references
     static bool extract2Profiles(std::string varname, int ilaser, std::vector<PyObject*> &profiles )
     {
-        PyObject* py_obj = extract_py(varname,"Laser",ilaser);
+        ComponentView *view = componentOf(varname,"Laser",ilaser);
+        PyObject* py_obj = view ? view->object(varname) : NULL;
         // Return false if None
         if( py_obj==Py_None ) return false;
         
@@ -387,18 +1225,28 @@ public:
                 ERROR("For Laser #" << ilaser << ": "<<varname<<"["<<i<<"] not understood");
         }
         
+        for (unsigned int i=0; i<profiles.size(); i++) Py_INCREF(profiles[i]);
         return true;
     }
     
     //! return the number of components (see pyinit.py)
     static unsigned int nComponents(std::string componentName) {
+        INSTRUMENT_CALL("nComponents " + componentName);
+        if (NamelistSnapshot::replaying()) {
+            unsigned int n = 0;
+            NamelistSnapshot::get(NamelistSnapshot::componentsKey(componentName), n);
+            return n;
+        }
         // Get the selected component (e.g. "Species" or "Laser")
         if (!Py_IsInitialized()) ERROR("Python not initialized: this should not happen");
-        PyObject *py_obj = PyObject_GetAttrString(PyImport_AddModule("__main__"),componentName.c_str());
+        ComponentView *view = componentView();
+        PyObject *py_obj = view ? view->object(componentName) : NULL;
+        Py_ssize_t retval = py_obj ? PyObject_Length(py_obj) : -1;
         PyTools::checkPyError();
-        Py_ssize_t retval = PyObject_Length(py_obj);
         if (retval < 0) {
             ERROR("Problem searching for component " << componentName);
+        } else if (NamelistSnapshot::recording()) {
+            NamelistSnapshot::put(NamelistSnapshot::componentsKey(componentName), retval);
         }
         return retval;
     }
@@ -406,6 +1254,9 @@ public:
     //! Get an object's attribute ( int, double, etc.)
     template <typename T>
     static bool getAttr(PyObject* object, std::string attr_name, T & value) {
+        // component blocks are served by their view
+        ComponentView *view = componentView(object);
+        if (view) return view->get(attr_name, value);
         bool success = false;
         if( PyObject_HasAttrString(object, attr_name.c_str()) ) {
             PyObject* py_value = PyObject_GetAttrString(object, attr_name.c_str());
@@ -418,6 +1269,8 @@ public:
     //! Get an object's attribute for lists
     template <typename T>
     static bool getAttr(PyObject* object, std::string attr_name, std::vector<T> & vec) {
+        ComponentView *view = componentView(object);
+        if (view && view->get(attr_name, vec)) return true;
         bool success = false;
         if( PyObject_HasAttrString(object, attr_name.c_str()) ) {
             PyObject* py_list = PyObject_GetAttrString(object, attr_name.c_str());
@@ -427,26 +1280,31 @@ public:
         return success;
     }
     
-    //! Get an object's attribute for lists of list
+    //! Get an object's attribute for arrays of any dimension (numpy array, buffer, or nested lists)
     template <typename T>
-    static bool getAttr(PyObject* object, std::string attr_name, std::vector<std::vector<T> > & vec) {
+    static bool getAttr(PyObject* object, std::string attr_name, PyArrayView<T> & view) {
+        bool success = false;
         if( PyObject_HasAttrString(object, attr_name.c_str()) ) {
-            // Get the list of lists
-            PyObject* py_list = PyObject_GetAttrString(object, attr_name.c_str());
-            // Convert to vector of lists
-            std::vector<PyObject*> py_vec;
-            if( !convert(py_list, py_vec) ) return false;
-            Py_XDECREF(py_list);
-            // For each list, convert to vector
-            vec.resize(0);
-            std::vector<T> v;
-            for( unsigned int i=0; i<py_vec.size(); i++ ) {
-                if( !convert( py_vec[i], v ) ) return false;
-                vec.push_back( v );
-            }
+            PyObject* py_value = PyObject_GetAttrString(object, attr_name.c_str());
+            success = view.assign(py_value);
+            Py_XDECREF(py_value);
         }
-        //This should never happen
-        return false;
+        return success;
+    }
+    
+    //! Get an object's attribute for lists of list (rows of a 2D array)
+    template <typename T>
+    static bool getAttr(PyObject* object, std::string attr_name, std::vector<std::vector<T> > & vec) {
+        PyArrayView<T> view;
+        if( !getAttr(object, attr_name, view) || view.ndim() != 2 ) return false;
+        std::vector<T> flat;
+        view.copyTo(flat);
+        size_t nrows = view.shape(0), ncols = view.shape(1);
+        vec.resize(nrows);
+        for( size_t i=0; i<nrows; i++ ) {
+            vec[i].assign(flat.begin()+i*ncols, flat.begin()+(i+1)*ncols);
+        }
+        return true;
     }
     
     //! Get an object's repr
@@ -460,4 +1318,473 @@ public:
     
 };
 
+
+inline bool NamelistSnapshot::save(std::string fname)
+{
+    std::map<std::string, Record> & records = state().records;
+    std::string header("NICOSNAP", 8);
+    uint32_t words[2] = { version, byte_order_mark };
+    uint64_t nentries = records.size();
+    header.append((const char*) words, sizeof(words));
+    header.append((const char*) &nentries, sizeof(nentries));
+    std::ostringstream out;
+    for (std::map<std::string, Record>::iterator it=records.begin(); it!=records.end(); it++) {
+        const Record & r = it->second;
+        bool numeric = (r.kind == kind_numbers || r.kind == kind_table);
+        uint32_t entry[2] = { r.kind, (uint32_t) it->first.size() };
+        uint64_t count = numeric ? r.numbers.size() : r.text.size();
+        out.write((const char*) entry, sizeof(entry));
+        out.write((const char*) &count, sizeof(count));
+        out.write(it->first.data(), it->first.size());
+        pad(out, it->first.size());
+        if (numeric) {
+            if (count) out.write((const char*) &r.numbers[0], count*sizeof(double));
+        } else {
+            out.write(r.text.data(), count);
+            pad(out, count);
+        }
+    }
+    // the file appears only once complete
+    std::string entries = out.str();
+    if (!PyTools::writeFileAtomically(fname, header, entries.data(), entries.size())) {
+        ERROR("Cannot write namelist snapshot " << fname);
+        return false;
+    }
+    return true;
+}
+
+
+//! View of a python array (numpy array or any object with the buffer protocol) as a C++ array of T,
+//! with its shape and strides. The python memory is used directly when its elements are of type T,
+//! otherwise (other element type, nested lists) the values are converted once into a row-major copy.
+template <typename T>
+class PyArrayView {
+public:
+    PyArrayView() : has_buffer(false), ptr(NULL) {};
+    ~PyArrayView() {
+        release();
+    };
+    
+    //! View the python object, returns false if it is not an array of numbers
+    bool assign(PyObject *py_obj) {
+        release();
+        if (!py_obj) return false;
+        if (PyObject_CheckBuffer(py_obj)) {
+            if (PyObject_GetBuffer(py_obj, &buffer, PyBUF_RECORDS_RO) != 0) {
+                PyErr_Clear();
+                return false;
+            }
+            has_buffer = true;
+            dims.assign(buffer.shape, buffer.shape + buffer.ndim);
+            if (buffer.strides) {
+                byte_strides.assign(buffer.strides, buffer.strides + buffer.ndim);
+            } else {
+                byte_strides.resize(buffer.ndim);
+                Py_ssize_t stride = buffer.itemsize;
+                for (int i=buffer.ndim-1; i>=0; i--) {
+                    byte_strides[i] = stride;
+                    stride *= dims[i];
+                }
+            }
+            format = buffer.format ? buffer.format : "B";
+            // leading byte order / alignment character
+            if (format.size() > 1 && std::string("@=<>!").find(format[0]) != std::string::npos) format = format.substr(1);
+            if (format.size() != 1 || std::string("dfbBhHiIlLqQ?").find(format[0]) == std::string::npos) {
+                release();
+                return false;
+            }
+            if (matchesType() && PyBuffer_IsContiguous(&buffer, 'C')) {
+                ptr = (const T*) buffer.buf;
+            } else {
+                // other element type or non-contiguous: one conversion into a row-major copy
+                copyTo(owned);
+                ptr = owned.size() ? &owned[0] : NULL;
+            }
+            return true;
+        }
+        // nested lists or tuples
+        dims.clear();
+        PyObject *item = py_obj;
+        while (PyList_Check(item) || PyTuple_Check(item)) {
+            dims.push_back(PySequence_Size(item));
+            if (dims.back() == 0) break;
+            item = PySequence_Fast_GET_ITEM(item, 0);
+        }
+        if (dims.empty()) return false;
+        byte_strides.resize(dims.size());
+        Py_ssize_t stride = sizeof(T);
+        for (int i=dims.size()-1; i>=0; i--) {
+            byte_strides[i] = stride;
+            stride *= dims[i];
+        }
+        owned.clear();
+        owned.reserve(size());
+        if (!flatten(py_obj, 0)) {
+            dims.clear();
+            owned.clear();
+            return false;
+        }
+        ptr = owned.size() ? &owned[0] : NULL;
+        return true;
+    }
+    
+    //! Contiguous row-major data
+    inline const T * data() {
+        return ptr;
+    };
+    //! Whether the data is the memory of the python object
+    inline bool isZeroCopy() {
+        return has_buffer && ptr == (const T*) buffer.buf;
+    };
+    
+    inline unsigned int ndim() {
+        return dims.size();
+    };
+    inline size_t shape(unsigned int i) {
+        return dims[i];
+    };
+    //! Strides of the python memory in bytes
+    inline Py_ssize_t strides(unsigned int i) {
+        return byte_strides[i];
+    };
+    inline size_t size() {
+        size_t n = 1;
+        for (unsigned int i=0; i<dims.size(); i++) n *= dims[i];
+        return n;
+    };
+    
+    //! Copy all the elements in a flat row-major vector, in a single pass
+    bool copyTo(std::vector<T> & vec) {
+        vec.resize(size());
+        if (vec.empty()) return true;
+        if (ptr) {
+            std::copy(ptr, ptr+vec.size(), vec.begin());
+        } else if (has_buffer) {
+            if (matchesType() && PyBuffer_IsContiguous(&buffer, 'C')) {
+                memcpy(&vec[0], buffer.buf, vec.size()*sizeof(T));
+            } else {
+                std::vector<size_t> index(dims.size(), 0);
+                for (size_t k=0; k<vec.size(); k++) {
+                    const char * item = (const char *) buffer.buf;
+                    for (unsigned int i=0; i<dims.size(); i++) item += index[i] * byte_strides[i];
+                    vec[k] = (T) element(item);
+                    for (int i=dims.size()-1; i>=0; i--) {
+                        if (++index[i] < (size_t)dims[i]) break;
+                        index[i] = 0;
+                    }
+                }
+            }
+        } else {
+            return false;
+        }
+        return true;
+    }
+    
+private:
+    //! No copy (the buffer would be released twice)
+    PyArrayView(const PyArrayView &);
+    PyArrayView & operator=(const PyArrayView &);
+    
+    void release() {
+        // after closePython the memory is already gone with the interpreter
+        if (has_buffer && Py_IsInitialized()) {
+            PyTools::GILState gil;
+            PyBuffer_Release(&buffer);
+        }
+        has_buffer = false;
+        ptr = NULL;
+        owned.clear();
+        dims.clear();
+        byte_strides.clear();
+    }
+    
+    //! Whether the elements of the buffer are of type T
+    bool matchesType() {
+        char f = format[0];
+        if ((Py_ssize_t)sizeof(T) != buffer.itemsize) return false;
+        if (f == 'd' || f == 'f') return (T)0.5 != 0;
+        return (T)0.5 == 0 && f != '?' && ((T)-1 < 0) == (f == 'b' || f == 'h' || f == 'i' || f == 'l' || f == 'q');
+    }
+    
+    //! Element of the buffer at the given address, as a double
+    double element(const char * item) {
+        switch (format[0]) {
+            case 'd': return *(const double*) item;
+            case 'f': return *(const float*) item;
+            case 'b': return *(const signed char*) item;
+            case 'B': return *(const unsigned char*) item;
+            case 'h': return *(const short*) item;
+            case 'H': return *(const unsigned short*) item;
+            case 'i': return *(const int*) item;
+            case 'I': return *(const unsigned int*) item;
+            case 'l': return *(const long*) item;
+            case 'L': return *(const unsigned long*) item;
+            case 'q': return *(const long long*) item;
+            case 'Q': return *(const unsigned long long*) item;
+            case '?': return *(const bool*) item;
+        }
+        return 0.;
+    }
+    
+    //! Append the elements of nested lists, verifying that they are rectangular
+    bool flatten(PyObject *py_obj, unsigned int level) {
+        if (level == dims.size()) {
+            T value;
+            if (!PyTools::convert(py_obj, value)) return false;
+            owned.push_back(value);
+            return true;
+        }
+        if (!(PyList_Check(py_obj) || PyTuple_Check(py_obj)) || PySequence_Size(py_obj) != dims[level]) return false;
+        for (Py_ssize_t i=0; i<dims[level]; i++) {
+            if (!flatten(PySequence_Fast_GET_ITEM(py_obj, i), level+1)) return false;
+        }
+        return true;
+    }
+    
+    Py_buffer buffer;
+    bool has_buffer;
+    std::string format;
+    std::vector<Py_ssize_t> dims, byte_strides;
+    //! converted copy, when the python memory cannot be used directly
+    std::vector<T> owned;
+    const T * ptr;
+};
+
+
+//  -------------------------------------------------------------------------------------------
+//! Export of a C++ array to python without copy (the reverse of PyArrayView): view() gives a
+//! numpy array (a memoryview without numpy) on the C++ memory, with its shape, strides and
+//! element type, writable or not, e.g. to pass fields to a namelist function.
+//! Lifetime: with an owner (a shared_ptr holding the memory), the python objects keep the memory
+//! alive as long as they exist. Without owner, python could keep views (e.g. in a global) after the
+//! memory is freed, so the views are on a copy owned by the export and its python objects, made by the
+//! first view(): the memory is only borrowed until release() or the destruction of the export, which
+//! copy back the changes made by python in writable views. After that python cannot make new views
+//! (ValueError), and the views it kept stay on the copy. Exports without copy need an owner.
+//! The python type is created once per interpreter (a heap type with the buffer protocol).
+//  -------------------------------------------------------------------------------------------
+class PyArrayExport {
+public:
+    //! shape and strides (in elements, row-major contiguous if empty) of the array at data
+    template <typename T>
+    PyArrayExport(T * data, std::vector<size_t> shape, bool writable=false, std::vector<size_t> strides=std::vector<size_t>(),
+                  std::shared_ptr<void> owner=std::shared_ptr<void>()) : state(std::make_shared<State>()), borrowed(NULL) {
+        static_assert(std::is_arithmetic<T>::value, "PyArrayExport: only arrays of numbers can be exported");
+        state->data = (void *) data;
+        state->itemsize = sizeof(T);
+        state->format = formatOf<T>();
+        state->readonly = !writable || std::is_const<T>::value;
+        state->owner = owner;
+        state->shape.assign(shape.begin(), shape.end());
+        if (strides.empty()) {
+            state->strides.resize(shape.size());
+            Py_ssize_t stride = sizeof(T);
+            for (int i=shape.size()-1; i>=0; i--) {
+                state->strides[i] = stride;
+                stride *= shape[i];
+            }
+        } else if (strides.size() == shape.size()) {
+            for (unsigned int i=0; i<strides.size(); i++) state->strides.push_back(strides[i] * sizeof(T));
+        } else {
+            ERROR("PyArrayExport: " << strides.size() << " strides for " << shape.size() << " dimensions");
+            state->data = NULL;
+        }
+        state->size = 1;
+        for (unsigned int i=0; i<shape.size(); i++) state->size *= shape[i];
+        if (!owner) {
+            borrowed = state->data;
+            borrowed_strides = state->strides;
+        }
+    };
+    ~PyArrayExport() {
+        release();
+    };
+    
+    //! New python array on the memory, or on its copy without owner (NULL with a python error after release)
+    PyTools::PyRef view() {
+        PyTools::GILState gil;
+        PyObject *type = pythonType();
+        if (!type) return PyTools::PyRef();
+        if (!state->owner) {
+            std::lock_guard<std::mutex> lock(state->mutex);
+            if (borrowed && state->copy.empty() && state->size > 0) {
+                // contiguous copy of the borrowed memory
+                state->copy.resize(state->size * state->itemsize);
+                Py_ssize_t stride = state->itemsize;
+                for (int i=state->shape.size()-1; i>=0; i--) {
+                    state->strides[i] = stride;
+                    stride *= state->shape[i];
+                }
+                copyElements(&state->copy[0], state->strides, (const char *) borrowed, borrowed_strides);
+                state->data = &state->copy[0];
+            }
+        }
+        PyTools::PyRef exported(PyType_GenericAlloc((PyTypeObject *) type, 0));
+        if (!exported) return exported;
+        ((Object *) exported.get())->state = new std::shared_ptr<State>(state);
+        // through a memoryview, as numpy makes an object array of anything without buffer
+        PyTools::PyRef memory(PyMemoryView_FromObject(exported));
+        PyObject *np = PyTools::numpy();
+        if (!memory || !np) return memory;
+        return PyTools::PyRef(PyObject_CallMethod(np, const_cast<char *>("asarray"), const_cast<char *>("(O)"), memory.get()));
+    };
+    
+    //! End of the borrowing of the memory (without owner): the changes made by python in writable views
+    //! are copied back, and python cannot make new views
+    void release() {
+        std::lock_guard<std::mutex> lock(state->mutex);
+        if (state->owner || !borrowed) return;
+        if (!state->copy.empty() && !state->readonly) {
+            copyElements((char *) borrowed, borrowed_strides, &state->copy[0], state->strides);
+        }
+        borrowed = NULL;
+        state->released = true;
+    };
+    
+    //! Number of buffers on the memory currently held by python
+    inline long exports() {
+        std::lock_guard<std::mutex> lock(state->mutex);
+        return state->exports;
+    };
+    
+private:
+    //! Description of the array, shared by the export and its python objects
+    //! (the objects may live in several interpreters, hence the mutex)
+    struct State {
+        State() : data(NULL), itemsize(0), size(0), readonly(true), released(false), exports(0) {};
+        void * data;
+        Py_ssize_t itemsize, size;
+        const char * format;
+        std::vector<Py_ssize_t> shape, strides;
+        bool readonly, released;
+        std::shared_ptr<void> owner;
+        //! copy of the borrowed memory (without owner)
+        std::vector<char> copy;
+        long exports;
+        std::mutex mutex;
+    };
+    std::shared_ptr<State> state;
+    
+    //! Memory borrowed until release (without owner), and its strides in bytes
+    void * borrowed;
+    std::vector<Py_ssize_t> borrowed_strides;
+    
+    //! The python object
+    struct Object {
+        PyObject_HEAD
+        std::shared_ptr<State> * state;
+    };
+    
+    //! No copy (the borrowed memory would be released twice)
+    PyArrayExport(const PyArrayExport &);
+    PyArrayExport & operator=(const PyArrayExport &);
+    
+    //! Buffer protocol format of T
+    template <typename T>
+    static const char * formatOf() {
+        typedef typename std::remove_const<T>::type U;
+        if (std::is_same<U, bool>::value) return "?";
+        if (std::is_floating_point<U>::value) return sizeof(U) == sizeof(float) ? "f" : "d";
+        bool sign = std::is_signed<U>::value;
+        switch (sizeof(U)) {
+            case 1:  return sign ? "b" : "B";
+            case 2:  return sign ? "h" : "H";
+            case 4:  return sign ? "i" : "I";
+            default: return sign ? "q" : "Q";
+        }
+    }
+    
+    //! Copy of the elements of the array from src to dst (strides in bytes)
+    void copyElements(char * dst, const std::vector<Py_ssize_t> &dst_strides, const char * src, const std::vector<Py_ssize_t> &src_strides) {
+        unsigned int ndim = state->shape.size();
+        std::vector<Py_ssize_t> index(ndim, 0);
+        for (Py_ssize_t k=0; k<state->size; k++) {
+            Py_ssize_t dst_offset = 0, src_offset = 0;
+            for (unsigned int i=0; i<ndim; i++) {
+                dst_offset += index[i] * dst_strides[i];
+                src_offset += index[i] * src_strides[i];
+            }
+            memcpy(dst + dst_offset, src + src_offset, state->itemsize);
+            for (int i=ndim-1; i>=0; i--) {
+                if (++index[i] < state->shape[i]) break;
+                index[i] = 0;
+            }
+        }
+    }
+    
+    static int getBuffer(PyObject *self, Py_buffer *view, int flags) {
+        State &s = **((Object *) self)->state;
+        std::lock_guard<std::mutex> lock(s.mutex);
+        if (!s.data || s.released) {
+            PyErr_SetString(PyExc_ValueError, "the C++ array was released");
+            return -1;
+        }
+        if ((flags & PyBUF_WRITABLE) == PyBUF_WRITABLE && s.readonly) {
+            PyErr_SetString(PyExc_BufferError, "the C++ array is read-only");
+            return -1;
+        }
+        bool contiguous = true;
+        Py_ssize_t stride = s.itemsize;
+        for (int i=s.shape.size()-1; i>=0; i--) {
+            if (s.shape[i] > 1 && s.strides[i] != stride) contiguous = false;
+            stride *= s.shape[i];
+        }
+        if ((flags & PyBUF_STRIDES) != PyBUF_STRIDES && !contiguous) {
+            PyErr_SetString(PyExc_BufferError, "the C++ array is not contiguous");
+            return -1;
+        }
+        view->buf = s.data;
+        view->obj = self;
+        Py_INCREF(self);
+        view->len = s.size * s.itemsize;
+        view->itemsize = s.itemsize;
+        view->readonly = s.readonly;
+        view->ndim = s.shape.size();
+        view->format = (flags & PyBUF_FORMAT) ? const_cast<char *>(s.format) : NULL;
+        view->shape = (flags & PyBUF_ND) == PyBUF_ND ? s.shape.data() : NULL;
+        view->strides = (flags & PyBUF_STRIDES) == PyBUF_STRIDES ? s.strides.data() : NULL;
+        view->suboffsets = NULL;
+        view->internal = NULL;
+        s.exports++;
+        return 0;
+    }
+    
+    static void releaseBuffer(PyObject *self, Py_buffer *) {
+        State &s = **((Object *) self)->state;
+        std::lock_guard<std::mutex> lock(s.mutex);
+        s.exports--;
+    }
+    
+    static void dealloc(PyObject *self) {
+        PyTypeObject *type = Py_TYPE(self);
+        delete ((Object *) self)->state;
+        type->tp_free(self);
+        Py_DECREF(type);
+    }
+    
+    //! Type of the python objects in the current interpreter (borrowed reference)
+    static PyObject * pythonType() {
+#if PY_VERSION_HEX >= 0x03090000
+        PyObject *dict = PyInterpreterState_GetDict(PyThreadState_Get()->interp);
+        if (!dict) return NULL;
+        PyObject *type = PyDict_GetItemString(dict, "nico.PyArrayExport");
+        if (type) return type;
+        static PyType_Slot slots[] = {
+            {Py_bf_getbuffer, (void *) getBuffer},
+            {Py_bf_releasebuffer, (void *) releaseBuffer},
+            {Py_tp_dealloc, (void *) dealloc},
+            {Py_tp_doc, (void *) "C++ array exported without copy"},
+            {0, NULL}
+        };
+        static PyType_Spec spec = {"nico.PyArrayExport", sizeof(Object), 0, Py_TPFLAGS_DEFAULT, slots};
+        PyTools::PyRef new_type(PyType_FromSpec(&spec));
+        if (!new_type || PyDict_SetItemString(dict, "nico.PyArrayExport", new_type) != 0) return NULL;
+        return PyDict_GetItemString(dict, "nico.PyArrayExport");
+#else
+        PyErr_SetString(PyExc_NotImplementedError, "exporting C++ arrays needs python 3.9");
+        return NULL;
+#endif
+    }
+};
+
 #endif
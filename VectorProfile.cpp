@@ -0,0 +1,302 @@
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+
+#include "VectorProfile.h"
+#include "PyTools.h"
+
+using namespace std;
+
+VectorProfile::VectorProfile(string name, unsigned int ncomponents, string component, int nComponent, bool spacetime) :
+    name(name),
+    spacetime(spacetime),
+    ncomponents(ncomponents),
+    nvariables(0),
+    call(NULL),
+    vectorized(-1)
+{
+    if (NamelistSnapshot::replaying()) {
+        ERROR("Vector profile " << name << " cannot be evaluated when replaying a namelist snapshot");
+        return;
+    }
+    PyTools::PyRef py_obj(PyTools::extract_py(name, component, nComponent));
+    vector<PyObject*> py_profiles;
+    if (py_obj && PyCallable_Check(py_obj)) {
+        init(py_obj);
+    } else if (py_obj && PyTools::convert(py_obj, py_profiles) && !py_profiles.empty()) {
+        init(py_profiles);
+    } else {
+        ERROR("Vector profile " << name << " must be a function or a list of " << ncomponents << " functions");
+    }
+}
+
+VectorProfile::VectorProfile(PyObject *py_profile, unsigned int ncomponents, string name, bool spacetime) :
+    name(name),
+    spacetime(spacetime),
+    ncomponents(ncomponents),
+    nvariables(0),
+    call(NULL),
+    vectorized(-1)
+{
+    init(py_profile);
+}
+
+VectorProfile::VectorProfile(vector<PyObject*> py_profiles, string name, bool spacetime) :
+    name(name),
+    spacetime(spacetime),
+    ncomponents(py_profiles.size()),
+    nvariables(0),
+    call(NULL),
+    vectorized(-1)
+{
+    init(py_profiles);
+}
+
+void VectorProfile::init(PyObject *py_function)
+{
+    if (!PyCallable_Check(py_function)) {
+        ERROR("Vector profile " << name << ": not a function");
+        return;
+    }
+    int size = PyTools::nArguments(py_function);
+    if (size < 1 || size > (int)Profile::max_variables) {
+        ERROR("Vector profile " << name << " has " << size << " arguments (1 to " << Profile::max_variables << " expected)");
+        return;
+    }
+    py_profile = PyTools::PyRef::borrow(py_function);
+    nvariables = size;
+    call = new PyTools::FastCall(py_profile, nvariables);
+}
+
+void VectorProfile::init(const vector<PyObject*> &py_profiles)
+{
+    // A single function in a list is the same for all the components
+    if (py_profiles.size() != 1 && py_profiles.size() != ncomponents) {
+        ERROR("Vector profile " << name << " needs 1 or " << ncomponents << " functions (got " << py_profiles.size() << ")");
+        return;
+    }
+    vector<PyObject*> distinct;
+    for (unsigned int c=0; c<ncomponents; c++) {
+        PyObject *f = py_profiles[py_profiles.size()==1 ? 0 : c];
+        unsigned int d = find(distinct.begin(), distinct.end(), f) - distinct.begin();
+        profile_of.push_back(d);
+        if (d < distinct.size()) continue;
+        distinct.push_back(f);
+        profiles.push_back(new Profile(f, name + "[" + to_string(c) + "]", spacetime));
+        if (profiles.size() == 1) {
+            nvariables = profiles[0]->getNvariables();
+        } else if (profiles.back()->getNvariables() != nvariables) {
+            ERROR("Vector profile " << name << ": component " << c << " has " << profiles.back()->getNvariables()
+                  << " variables instead of " << nvariables);
+        }
+    }
+}
+
+VectorProfile::~VectorProfile()
+{
+    for (unsigned int d=0; d<profiles.size(); d++) delete profiles[d];
+    delete call;
+}
+
+void VectorProfile::valueAt(const double * coordinates, double * values)
+{
+    INSTRUMENT_CALL("vector profile " + name);
+    if (!py_profile) {
+        for (unsigned int c=0; c<ncomponents; c++) {
+            unsigned int first = 0;
+            while (profile_of[first] != profile_of[c]) first++;
+            values[c] = (first < c) ? values[first] : profiles[profile_of[c]]->valueAt(coordinates);
+        }
+        return;
+    }
+    PyTools::GILState gil;
+    PyObject *result = call->object(coordinates);
+    if (!convert(result, values, 1)) {
+        fill(values, values+ncomponents, 0.);
+        call->error();
+    }
+    Py_XDECREF(result);
+    call->checkErrors();
+}
+
+void VectorProfile::valuesAt(const vector<double*> &coordinates, unsigned int npoints, double * values, ComponentLayout components)
+{
+    INSTRUMENT_CALL("vector profile " + name, npoints);
+    if (components == components_interleaved) {
+        evaluate(coordinates, npoints, values, ncomponents, 1);
+    } else {
+        evaluate(coordinates, npoints, values, 1, npoints);
+    }
+}
+
+void VectorProfile::valuesAt(const vector<double*> &coordinates, double time, unsigned int npoints, double * values,
+                             ComponentLayout components)
+{
+    vector<double> times(npoints, time);
+    vector<double*> with_time(coordinates);
+    with_time.push_back(&times[0]);
+    valuesAt(with_time, npoints, values, components);
+}
+
+// Same odometer as Function::valuesAtGrid, each block filling all the components of its points
+void VectorProfile::valuesAtGrid(vector<vector<double> > axes, double * values, ProfileLayout layout,
+                                 ComponentLayout components, unsigned int chunk_size)
+{
+    INSTRUMENT_CALL("vector profile " + name);
+    unsigned int ndim = axes.size();
+    if (ndim != nvariables) {
+        ERROR("Vector profile: grid has " << ndim << " axes but the profile has " << nvariables << " variables");
+        return;
+    }
+    size_t npoints = 1;
+    for (unsigned int i=0; i<ndim; i++) npoints *= axes[i].size();
+    if (npoints == 0) return;
+    if (chunk_size == 0) chunk_size = 1;
+    size_t point_stride = (components == components_interleaved) ? ncomponents : 1;
+    size_t component_stride = (components == components_interleaved) ? 1 : npoints;
+
+    vector<unsigned int> order(ndim);
+    for (unsigned int i=0; i<ndim; i++) order[i] = (layout==layout_rowMajor) ? ndim-1-i : i;
+    vector<vector<double> > buffer(ndim, vector<double>(min((size_t)chunk_size, npoints)));
+    vector<double*> coordinates(ndim);
+    for (unsigned int i=0; i<ndim; i++) coordinates[i] = &buffer[i][0];
+    vector<size_t> index(ndim, 0);
+
+    for (size_t start=0; start<npoints; start+=chunk_size) {
+        unsigned int n = (unsigned int) min((size_t)chunk_size, npoints-start);
+        for (unsigned int p=0; p<n; p++) {
+            for (unsigned int i=0; i<ndim; i++) buffer[i][p] = axes[i][index[i]];
+            for (unsigned int k=0; k<ndim; k++) {
+                unsigned int i = order[k];
+                if (++index[i] < axes[i].size()) break;
+                index[i] = 0;
+            }
+        }
+        evaluate(coordinates, n, values + start*point_stride, point_stride, component_stride);
+    }
+}
+
+void VectorProfile::valuesAtGrid(vector<vector<double> > axes, double time, double * values, ProfileLayout layout,
+                                 ComponentLayout components, unsigned int chunk_size)
+{
+    axes.push_back(vector<double>(1, time));
+    valuesAtGrid(axes, values, layout, components, chunk_size);
+}
+
+void VectorProfile::evaluate(const vector<double*> &coordinates, unsigned int npoints, double * out,
+                             size_t point_stride, size_t component_stride)
+{
+    if (npoints == 0) return;
+
+    // One function per component: each distinct function fills a block, copied to its components
+    if (!py_profile) {
+        vector<double> block;
+        for (unsigned int d=0; d<profiles.size(); d++) {
+            unsigned int first = 0;
+            while (profile_of[first] != d) first++;
+            double * plane = out + first*component_stride;
+            if (point_stride != 1) {
+                block.resize(npoints);
+                plane = &block[0];
+            }
+            profiles[d]->valuesAt(coordinates, npoints, plane);
+            for (unsigned int c=0; c<ncomponents; c++) {
+                if (profile_of[c] != d || plane == out + c*component_stride) continue;
+                double * o = out + c*component_stride;
+                if (point_stride == 1) {
+                    memcpy(o, plane, npoints*sizeof(double));
+                } else {
+                    for (unsigned int p=0; p<npoints; p++) o[p*point_stride] = plane[p];
+                }
+            }
+        }
+        return;
+    }
+
+    PyTools::GILState gil;
+    double x[Profile::max_variables];
+
+    // One python call for the whole block when the function accepts numpy arrays
+    if (vectorized != 0) {
+        vector<double> planes(npoints*ncomponents);
+        if (PyTools::runPyFunction(py_profile, coordinates, npoints, &planes[0], ncomponents)) {
+            if (vectorized < 0) {
+                // First batch: make sure that the array call gives the same result as the scalar call
+                vector<double> v(ncomponents);
+                for (unsigned int i=0; i<nvariables; i++) x[i] = coordinates[i][0];
+                PyObject *result = call->object(x);
+                bool same = convert(result, &v[0], 1);
+                Py_XDECREF(result);
+                PyErr_Clear();
+                for (unsigned int c=0; c<ncomponents && same; c++) {
+                    double w = planes[c*npoints];
+                    same = v[c] == w || abs(v[c]-w) <= 1e-12*abs(v[c]);
+                }
+                vectorized = same ? 1 : 0;
+            }
+            if (vectorized == 1) {
+                for (unsigned int c=0; c<ncomponents; c++) {
+                    const double * plane = &planes[c*npoints];
+                    double * o = out + c*component_stride;
+                    for (unsigned int p=0; p<npoints; p++) o[p*point_stride] = plane[p];
+                }
+                return;
+            }
+        } else {
+            vectorized = 0;
+        }
+    }
+
+    // One call per point, the first error being reported at the end of the block
+    for (unsigned int p=0; p<npoints; p++) {
+        for (unsigned int i=0; i<nvariables; i++) x[i] = coordinates[i][p];
+        PyObject *result = call->object(x);
+        double * o = out + p*point_stride;
+        if (!convert(result, o, component_stride)) {
+            for (unsigned int c=0; c<ncomponents; c++) o[c*component_stride] = 0.;
+            call->error();
+        }
+        Py_XDECREF(result);
+    }
+    call->checkErrors();
+}
+
+bool VectorProfile::convert(PyObject *result, double * out, size_t component_stride)
+{
+    INSTRUMENT_PART(part_conversion);
+    if (!result) return false;
+    if (PyFloat_Check(result) || PyLong_Check(result)) {
+        double v = PyFloat_AsDouble(result);
+        for (unsigned int c=0; c<ncomponents; c++) out[c*component_stride] = v;
+        return !PyErr_Occurred();
+    }
+    if (PyTools::convertComponents(result, ncomponents, out, component_stride)) return true;
+    PyErr_Clear();
+    PyErr_Format(PyExc_ValueError, "%s must return %u numbers, not %s", name.c_str(), ncomponents, PyTools::repr(result).c_str());
+    return false;
+}
+
+string VectorProfile::getInfo()
+{
+    string info = name + " (" + to_string(ncomponents) + " components of " + to_string(nvariables) + " variables"
+                + (spacetime ? ", the last one being time" : "") + "): ";
+    if (py_profile) {
+        info += "one python function for all the components";
+        if (vectorized == 1) info += " (vectorized)";
+        if (vectorized == 0) info += " (not vectorized)";
+        return info;
+    }
+    if (profiles.empty()) return info + "undefined";
+    for (unsigned int c=0; c<ncomponents; c++) {
+        unsigned int d = profile_of[c], first = 0;
+        while (profile_of[first] != d) first++;
+        info += (c ? "; " : "") + to_string(c) + ": ";
+        if (first < c) {
+            info += "same as " + to_string(first);
+        } else {
+            string component_info = profiles[d]->getInfo();
+            info += component_info.substr(component_info.find("): ")+3);
+        }
+    }
+    return info;
+}
@@ -0,0 +1,101 @@
+#ifndef VectorProfile_H
+#define VectorProfile_H
+
+#include <vector>
+#include <string>
+#include "Profile.h"
+
+//! Memory layout of the components in the values filled by VectorProfile
+enum ComponentLayout {
+    //! components of a point next to each other: values[p*ncomponents + c]
+    components_interleaved,
+    //! one block of npoints values per component (structure of arrays): values[c*npoints + p]
+    components_planar
+};
+
+//  -------------------------------------------------------------------------------------------
+//! Profile with several components (e.g. a mean velocity or a laser polarization), filling all
+//! the components of a batch of points in one pass. It is either
+//!   - one python function returning the ncomponents values as a tuple, list or array
+//!     (or a number, the same for all components), called once per point, or once per batch with
+//!     numpy arrays when the function accepts them (then returning an array of shape (ncomponents, npoints)),
+//!   - or one function per component, each evaluated as a Profile (compiled when the namelist asks for it),
+//!     a function given for several components being evaluated only once.
+//  -------------------------------------------------------------------------------------------
+class VectorProfile
+{
+public:
+    //! From the namelist: the attribute name of the component block is either one function returning
+    //! the ncomponents values, or a list of ncomponents functions (or of one function, the same for all)
+    VectorProfile(std::string name, unsigned int ncomponents, std::string component=std::string(""), int nComponent=0, bool spacetime=false);
+    //! One python function returning the ncomponents values
+    VectorProfile(PyObject *py_profile, unsigned int ncomponents, std::string name, bool spacetime=false);
+    //! One python function per component (e.g. from PyTools::extract3Profiles)
+    VectorProfile(std::vector<PyObject*> py_profiles, std::string name, bool spacetime=false);
+    //! Default destructor
+    ~VectorProfile();
+
+    //! Components of the profile at one point (nvariables coordinates), values[c] being the component c
+    void valueAt(const double * coordinates, double * values);
+
+    //! Components of the profile at a list of points (coordinates[i][p] is the coordinate i of point p)
+    void valuesAt(const std::vector<double*> &coordinates, unsigned int npoints, double * values,
+                  ComponentLayout components=components_interleaved);
+
+    //! Components of the profile on the rectilinear grid axes[0] x axes[1] x ..., the points being
+    //! ordered by layout, evaluated by blocks of at most chunk_size points
+    void valuesAtGrid(std::vector<std::vector<double> > axes, double * values, ProfileLayout layout=layout_rowMajor,
+                      ComponentLayout components=components_interleaved, unsigned int chunk_size=65536);
+
+    //! Same as valuesAt and valuesAtGrid for a space-time profile at a given time
+    void valuesAt(const std::vector<double*> &coordinates, double time, unsigned int npoints, double * values,
+                  ComponentLayout components=components_interleaved);
+    void valuesAtGrid(std::vector<std::vector<double> > axes, double time, double * values, ProfileLayout layout=layout_rowMajor,
+                      ComponentLayout components=components_interleaved, unsigned int chunk_size=65536);
+
+    //! Number of components of the profile
+    inline unsigned int getNcomponents() {
+        return ncomponents;
+    };
+
+    //! Number of variables of the profile functions (including the time)
+    inline unsigned int getNvariables() {
+        return nvariables;
+    };
+
+    //! Description of the profile and of how it is evaluated
+    std::string getInfo();
+
+private:
+    //! Name of the profile in the namelist
+    std::string name;
+
+    //! Whether the last variable is the time
+    bool spacetime;
+
+    unsigned int ncomponents, nvariables;
+
+    //! Function returning all the components (NULL with one function per component)
+    PyTools::PyRef py_profile;
+    //! calls of py_profile with reused arguments
+    PyTools::FastCall * call;
+
+    //! Whether py_profile accepts numpy arrays (-1 until the first batched call)
+    int vectorized;
+
+    //! One profile per distinct function, and the profile of each component
+    std::vector<Profile*> profiles;
+    std::vector<unsigned int> profile_of;
+
+    void init(PyObject *py_profile);
+    void init(const std::vector<PyObject*> &py_profiles);
+
+    //! Fills out[p*point_stride + c*component_stride] with the component c at point p
+    void evaluate(const std::vector<double*> &coordinates, unsigned int npoints, double * out,
+                  size_t point_stride, size_t component_stride);
+
+    //! Components from the result of py_profile at one point, returns false if it is not understood
+    bool convert(PyObject *result, double * out, size_t component_stride);
+};
+
+#endif
@@ -0,0 +1,458 @@
+// Benchmarks of the python bridge: profile calls, batched evaluations, extraction of values.
+//
+//   make bench
+//   bench/bench [--namelist bench/bench.py] [--sizes 1000,100000] [--warmup 1] [--trials 5]
+//               [--filter substring] [--format text|csv|json] [--output file] [--leak-check blocks]
+//
+// The benchmarks and the objects they use are compiled with BENCH_FLAGS (-O2 by default, see the makefile),
+// stated in the text report.
+// Each benchmark runs its work once per trial (after the warm-up runs) and reports
+// the time of one call and the number of items (points, list elements, ...) per second.
+// With --leak-check, the python memory blocks still allocated after the trials are counted too
+// (PyTools::allocatedBlocks, after a garbage collection); the benchmarks that keep more than the
+// given number of blocks per run are listed and the exit status is 1 (make leakcheck).
+
+#include "PyTools.h"
+#include "Profile.h"
+#include "ParallelEvaluator.h"
+#include "VectorProfile.h"
+#include "ProfileSampler.h"
+#include "ProfileIntegrator.h"
+#include "ProfileDispatcher.h"
+#include "FunctionNative.h"
+
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <algorithm>
+#include <thread>
+#include <mutex>
+
+using namespace std;
+
+// compiler and flags of the build (see the makefile)
+#ifndef BENCH_BUILD
+#define BENCH_BUILD "unknown flags"
+#endif
+
+struct Result {
+    string name;
+    size_t size, calls, items;
+    unsigned int trials;
+    double min, median, mean, stddev;
+    //! python memory blocks kept by each run (with --leak-check)
+    double blocks;
+};
+
+class Bench {
+public:
+    Bench() : warmup(1), trials(5), leak_check(false) {};
+
+    unsigned int warmup, trials;
+    string filter;
+    bool leak_check;
+    vector<Result> results;
+
+    //! Time work (calls calls processing items items in total), unless filtered out
+    void run(string name, size_t size, size_t calls, size_t items, function<void()> work) {
+        if (!filter.empty() && name.find(filter) == string::npos) return;
+        for (unsigned int i=0; i<warmup; i++) work();
+        long blocks = 0;
+        if (leak_check) {
+            // (the GIL may be released, e.g. by a ProfileDispatcher)
+            PyTools::GILState gil;
+            PyGC_Collect();
+            blocks = PyTools::allocatedBlocks();
+        }
+        vector<double> times(trials);
+        for (unsigned int i=0; i<trials; i++) {
+            chrono::steady_clock::time_point start = chrono::steady_clock::now();
+            work();
+            times[i] = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        }
+        sort(times.begin(), times.end());
+        Result r;
+        r.name = name;
+        r.size = size;
+        r.calls = calls;
+        r.items = items;
+        r.trials = trials;
+        r.min = times.front();
+        r.median = trials%2 ? times[trials/2] : 0.5*(times[trials/2-1]+times[trials/2]);
+        r.mean = 0.;
+        for (unsigned int i=0; i<trials; i++) r.mean += times[i] / trials;
+        r.stddev = 0.;
+        for (unsigned int i=0; i<trials; i++) r.stddev += (times[i]-r.mean)*(times[i]-r.mean) / trials;
+        r.stddev = sqrt(r.stddev);
+        r.blocks = 0.;
+        if (leak_check) {
+            PyTools::GILState gil;
+            PyGC_Collect();
+            r.blocks = (double) (PyTools::allocatedBlocks() - blocks) / trials;
+        }
+        results.push_back(r);
+        cerr << "." << flush;
+    }
+
+    void write(ostream &out, string format) {
+        if (format == "csv") {
+            out << "benchmark,size,calls,items,trials,min_s,median_s,mean_s,stddev_s,ns_per_call,items_per_s" << endl;
+            for (unsigned int i=0; i<results.size(); i++) {
+                Result &r = results[i];
+                out << r.name << "," << r.size << "," << r.calls << "," << r.items << "," << r.trials << ","
+                    << r.min << "," << r.median << "," << r.mean << "," << r.stddev << ","
+                    << 1e9*r.median/r.calls << "," << r.items/r.median << endl;
+            }
+        } else if (format == "json") {
+            out << "[" << endl;
+            for (unsigned int i=0; i<results.size(); i++) {
+                Result &r = results[i];
+                out << "  {\"benchmark\": \"" << r.name << "\", \"size\": " << r.size << ", \"calls\": " << r.calls
+                    << ", \"items\": " << r.items << ", \"trials\": " << r.trials
+                    << ", \"min_s\": " << r.min << ", \"median_s\": " << r.median << ", \"mean_s\": " << r.mean
+                    << ", \"stddev_s\": " << r.stddev << ", \"ns_per_call\": " << 1e9*r.median/r.calls
+                    << ", \"items_per_s\": " << r.items/r.median << "}" << (i+1<results.size() ? "," : "") << endl;
+            }
+            out << "]" << endl;
+        } else {
+            out << "compiled with " << BENCH_BUILD << endl;
+            out << left << setw(36) << "benchmark" << right << setw(10) << "size" << setw(14) << "ns/call"
+                << setw(14) << "items/s" << setw(12) << "stddev %";
+            if (leak_check) out << setw(12) << "blocks/run";
+            out << endl;
+            for (unsigned int i=0; i<results.size(); i++) {
+                Result &r = results[i];
+                out << left << setw(36) << r.name << right << setw(10) << r.size
+                    << setw(14) << setprecision(4) << 1e9*r.median/r.calls
+                    << setw(14) << setprecision(4) << r.items/r.median
+                    << setw(12) << setprecision(3) << 100.*r.stddev/r.mean;
+                if (leak_check) out << setw(12) << setprecision(3) << r.blocks;
+                out << endl;
+            }
+        }
+    }
+};
+
+//! Points in [0,1]^ndim
+static vector<vector<double> > randomPoints(unsigned int ndim, size_t npoints) {
+    vector<vector<double> > points(ndim, vector<double>(npoints));
+    unsigned long long state = 12345;
+    for (unsigned int i=0; i<ndim; i++) {
+        for (size_t p=0; p<npoints; p++) {
+            state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+            points[i][p] = (state >> 11) * (1./9007199254740992.);
+        }
+    }
+    return points;
+}
+
+static vector<double*> pointers(vector<vector<double> > &points) {
+    vector<double*> p(points.size());
+    for (unsigned int i=0; i<points.size(); i++) p[i] = &points[i][0];
+    return p;
+}
+
+//! One valueAt per point
+static void benchValueAt(Bench &bench, string name, Profile &profile, size_t n) {
+    unsigned int ndim = profile.getNvariables();
+    vector<vector<double> > points = randomPoints(ndim, n);
+    bench.run(name, n, n, n, [&]() {
+        vector<double> x(ndim);
+        volatile double sum = 0.;
+        for (size_t p=0; p<n; p++) {
+            for (unsigned int i=0; i<ndim; i++) x[i] = points[i][p];
+            sum += profile.valueAt(x);
+        }
+    });
+}
+
+//! One valuesAt for all the points
+static void benchValuesAt(Bench &bench, string name, Profile &profile, size_t n) {
+    unsigned int ndim = profile.getNvariables();
+    vector<vector<double> > points = randomPoints(ndim, n);
+    vector<double*> coordinates = pointers(points);
+    vector<double> values(n);
+    bench.run(name, n, 1, n, [&]() {
+        profile.valuesAt(coordinates, n, &values[0]);
+    });
+}
+
+static vector<size_t> parseSizes(string s) {
+    vector<size_t> sizes;
+    istringstream in(s);
+    string item;
+    while (getline(in, item, ',')) {
+        if (!item.empty()) sizes.push_back(stoul(item));
+    }
+    return sizes;
+}
+
+int main(int argc, char* argv[]) {
+
+    Bench bench;
+    string namelist = "bench/bench.py", format = "text", output;
+    vector<size_t> sizes = {1000, 100000};
+    double max_blocks = 0.;
+    for (int i=1; i<argc; i++) {
+        string arg = argv[i];
+        if (arg == "--help" || arg == "-h") {
+            cout << "Usage: " << argv[0] << " [options] (compiled with " << BENCH_BUILD << ")" << endl
+                 << "  --namelist file     namelist defining the profiles (bench/bench.py)" << endl
+                 << "  --sizes n1,n2,...   numbers of points of each benchmark (1000,100000)" << endl
+                 << "  --warmup n          runs before timing (1)" << endl
+                 << "  --trials n          timed runs (5)" << endl
+                 << "  --filter substring  only the benchmarks whose name contains it" << endl
+                 << "  --format format     text, csv or json (text)" << endl
+                 << "  --output file       report written to file instead of the standard output" << endl
+                 << "  --leak-check blocks exit status 1 if a benchmark keeps more python blocks per run" << endl;
+            return 0;
+        }
+        if (i+1 >= argc) {
+            cerr << "Missing value for " << arg << endl;
+            return 1;
+        }
+        string value = argv[++i];
+        if      (arg == "--namelist") namelist = value;
+        else if (arg == "--sizes")    sizes = parseSizes(value);
+        else if (arg == "--warmup")   bench.warmup = stoul(value);
+        else if (arg == "--trials")   bench.trials = max(1ul, stoul(value));
+        else if (arg == "--filter")   bench.filter = value;
+        else if (arg == "--format")   format = value;
+        else if (arg == "--output")   output = value;
+        else if (arg == "--leak-check") {
+            bench.leak_check = true;
+            max_blocks = stod(value);
+        }
+        else {
+            cerr << "Unknown option " << arg << endl;
+            return 1;
+        }
+    }
+
+    PyTools::openPython();
+    if (!PyTools::execFile(namelist)) return 1;
+
+    {
+        Profile py1("py1"), py2("py2"), py3("py3"), py4("py4");
+        Profile compiled1("compiled1"), compiled2("compiled2"), compiled3("compiled3"), compiled4("compiled4");
+        Profile *py[4] = {&py1, &py2, &py3, &py4};
+        Profile *compiled[4] = {&compiled1, &compiled2, &compiled3, &compiled4};
+        Profile scalar1("scalar1"), native1("native1"), native3("native3");
+        Profile tabulated1("compiled1"), tabulated3("compiled3");
+        Profile chebyshev1("py1"), chebyshev3("py3");
+        Profile separable3("separable3");
+        VectorProfile fused3("fused3", 3), separate3("separate3", 3);
+        separable3.factorize();
+        tabulated1.tabulate(vector<double>(1, 0.), vector<double>(1, 1.), vector<unsigned int>(1, 1001), 3, 1.);
+        tabulated3.tabulate(vector<double>(3, 0.), vector<double>(3, 1.), vector<unsigned int>(3, 65), 3, 1.);
+        // (the 3D expansion costs more than the default max_cost: timed anyway, unless refused)
+        bool expanded1 = chebyshev1.chebyshev(vector<double>(1, 0.), vector<double>(1, 1.), 1e-10) >= 0.;
+        bool expanded3 = chebyshev3.chebyshev(vector<double>(3, 0.), vector<double>(3, 1.), 1e-4, 1000, 1000) >= 0.;
+        if (!expanded1) cerr << "chebyshev/1D not expanded, skipped" << endl;
+        if (!expanded3) cerr << "chebyshev/3D not expanded, skipped" << endl;
+        PyTools::PyRef py_function(PyTools::extract_py("py1"));
+        unsigned int ncomponents = PyTools::nComponents("Species");
+
+        for (unsigned int s=0; s<sizes.size(); s++) {
+            size_t n = sizes[s];
+
+            // single calls
+            for (unsigned int d=0; d<4; d++) {
+                benchValueAt(bench, "call/python/" + to_string(d+1) + "D", *py[d], n);
+            }
+            bench.run("call/runPyFunction/1D", n, n, n, [&]() {
+                volatile double sum = 0.;
+                for (size_t p=0; p<n; p++) sum += PyTools::runPyFunction<double>(py_function, p*1e-3);
+            });
+            for (unsigned int d=0; d<4; d++) {
+                benchValueAt(bench, "call/compiled/" + to_string(d+1) + "D", *compiled[d], n);
+            }
+            benchValueAt(bench, "call/native/1D", native1, n);
+            if (Function_Gaussian *gaussian = native1.getFunction<Function_Gaussian>()) {
+                // final class: the call is inlined
+                vector<vector<double> > points = randomPoints(1, n);
+                bench.run("call/native-inline/1D", n, n, n, [&]() {
+                    volatile double sum = 0.;
+                    for (size_t p=0; p<n; p++) sum += gaussian->valueAt(&points[0][p]);
+                });
+            }
+            benchValueAt(bench, "call/tabulated/1D", tabulated1, n);
+            if (expanded1) benchValueAt(bench, "call/chebyshev/1D", chebyshev1, n);
+            if (expanded3) benchValueAt(bench, "call/chebyshev/3D", chebyshev3, n);
+
+            // batches of points
+            for (unsigned int d=0; d<4; d++) {
+                benchValuesAt(bench, "batch/python/" + to_string(d+1) + "D", *py[d], n);
+            }
+            benchValuesAt(bench, "batch/python-scalar/1D", scalar1, n);
+            for (unsigned int d=0; d<4; d++) {
+                benchValuesAt(bench, "batch/compiled/" + to_string(d+1) + "D", *compiled[d], n);
+            }
+            benchValuesAt(bench, "batch/native/1D", native1, n);
+            benchValuesAt(bench, "batch/native/3D", native3, n);
+            benchValuesAt(bench, "batch/tabulated/1D", tabulated1, n);
+            benchValuesAt(bench, "batch/tabulated/3D", tabulated3, n);
+            if (expanded1) benchValuesAt(bench, "batch/chebyshev/1D", chebyshev1, n);
+            if (expanded3) benchValuesAt(bench, "batch/chebyshev/3D", chebyshev3, n);
+            {
+                vector<vector<double> > points = randomPoints(3, n);
+                vector<double*> coordinates = pointers(points);
+                vector<double> values(3*n);
+                bench.run("batch/vector-fused/python/3D", n, 1, n, [&]() {
+                    fused3.valuesAt(coordinates, n, &values[0]);
+                });
+                bench.run("batch/vector-separate/python/3D", n, 1, n, [&]() {
+                    separate3.valuesAt(coordinates, n, &values[0]);
+                });
+            }
+
+            // single points from 4 threads, serialized by a lock or coalesced by a dispatcher
+            {
+                vector<vector<double> > points = randomPoints(3, n);
+                auto threaded = [&](function<void(size_t, size_t)> work) {
+                    vector<thread> threads;
+                    for (unsigned int t=0; t<4; t++) threads.push_back(thread(work, n*t/4, n*(t+1)/4));
+                    for (unsigned int t=0; t<4; t++) threads[t].join();
+                };
+                mutex lock;
+                bench.run("threads/locked/python/3D", n, n, n, [&]() {
+                    PyTools::GILRelease gil;
+                    threaded([&](size_t begin, size_t end) {
+                        volatile double sum = 0.;
+                        for (size_t p=begin; p<end; p++) {
+                            double x[3] = {points[0][p], points[1][p], points[2][p]};
+                            lock_guard<mutex> guard(lock);
+                            sum += py3.valueAt(x);
+                        }
+                    });
+                });
+                ProfileDispatcher dispatcher(py3);
+                bench.run("threads/dispatched/python/3D", n, n, n, [&]() {
+                    threaded([&](size_t begin, size_t end) {
+                        vector<future<double> > results;
+                        for (size_t p=begin; p<end; p++) {
+                            double x[3] = {points[0][p], points[1][p], points[2][p]};
+                            results.push_back(dispatcher.submit(x));
+                        }
+                        volatile double sum = 0.;
+                        for (size_t p=0; p<results.size(); p++) sum += results[p].get();
+                    });
+                });
+            }
+
+            // grids of about n points
+            {
+                unsigned int m = max(2, (int) round(cbrt((double) n)));
+                vector<vector<double> > axes = randomPoints(3, m);
+                for (unsigned int i=0; i<3; i++) sort(axes[i].begin(), axes[i].end());
+                size_t npoints = (size_t) m*m*m;
+                vector<double> values(npoints);
+                bench.run("grid/serial/python/3D", npoints, 1, npoints, [&]() {
+                    py3.valuesAtGrid(axes, &values[0]);
+                });
+                ParallelEvaluator evaluator;
+                bench.run("grid/parallel/python/3D", npoints, 1, npoints, [&]() {
+                    evaluator.valuesAtGrid(py3, axes, &values[0], layout_rowMajor, 4096);
+                });
+                bench.run("grid/parallel/compiled/3D", npoints, 1, npoints, [&]() {
+                    evaluator.valuesAtGrid(compiled3, axes, &values[0], layout_rowMajor, 4096);
+                });
+                bench.run("grid/factorized/python/3D", npoints, 1, npoints, [&]() {
+                    separable3.valuesAtGrid(axes, &values[0]);
+                });
+            }
+
+            // positions of particles distributed like a density (64^3 cells)
+            {
+                ProfileSampler sampler(compiled3, vector<double>(3, 0.), vector<double>(3, 1.), vector<unsigned int>(3, 64));
+                vector<vector<double> > positions(3, vector<double>(n));
+                vector<double*> coordinates = pointers(positions);
+                bench.run("sample/compiled/3D", n, 1, n, [&]() {
+                    sampler.sample(n, coordinates, 1);
+                });
+                bench.run("sample-threads/compiled/3D", n, 1, n, [&]() {
+                    sampler.sample(n, coordinates, 1, 0);
+                });
+            }
+
+            // integrals to a relative accuracy of 1e-10 (the size is not used)
+            {
+                ProfileIntegrator integrator(1e-10);
+                bench.run("integrate/python/1D", 1, 1, 1, [&]() {
+                    integrator.integrate(py1, vector<double>(1, -10.), vector<double>(1, 10.));
+                });
+                bench.run("integrate/compiled/3D", 1, 1, 1, [&]() {
+                    integrator.integrate(compiled3, vector<double>(3, -1.), vector<double>(3, 1.));
+                });
+            }
+
+            // profiles of a function already used by another profile (shared, see ProfileRegistry)
+            bench.run("construct/shared/python/1D", n, n, n, [&]() {
+                for (size_t p=0; p<n; p++) Profile profile("py1");
+            });
+
+            // extraction of values
+            bench.run("extract/scalar", n, n, n, [&]() {
+                double value;
+                for (size_t p=0; p<n; p++) PyTools::extract("scalar", value);
+            });
+            bench.run("extract/string", n, n, n, [&]() {
+                string value;
+                for (size_t p=0; p<n; p++) PyTools::extract("name", value);
+            });
+            // lists (and arrays) of n elements, extracted often enough to process about 1e6 elements
+            string list_name = "list_" + to_string(n), array_name = "array_" + to_string(n);
+            PyRun_SimpleString((list_name + " = [float(i) for i in range(" + to_string(n) + ")]").c_str());
+            size_t repeat = max((size_t) 1, (size_t) 1000000 / n);
+            bench.run("extract/list", n, repeat, repeat*n, [&]() {
+                vector<double> value;
+                for (size_t r=0; r<repeat; r++) PyTools::extract(list_name, value);
+            });
+            if (PyTools::numpy()) {
+                PyRun_SimpleString(("import numpy\n" + array_name + " = numpy.arange(" + to_string(n) + ", dtype=float)").c_str());
+                bench.run("extract/array", n, repeat, repeat*n, [&]() {
+                    vector<double> value;
+                    for (size_t r=0; r<repeat; r++) PyTools::extract(array_name, value);
+                });
+                bench.run("extract/array-view", n, repeat, repeat*n, [&]() {
+                    for (size_t r=0; r<repeat; r++) {
+                        PyArrayView<double> view;
+                        PyTools::extract(array_name, view);
+                    }
+                });
+            }
+
+            // components
+            bench.run("component/count", n, n, n, [&]() {
+                for (size_t p=0; p<n; p++) PyTools::nComponents("Species");
+            });
+            bench.run("component/attribute", n, n, n, [&]() {
+                double mass;
+                for (size_t p=0; p<n; p++) PyTools::extract("mass", mass, "Species", p % ncomponents);
+            });
+        }
+    }
+    cerr << endl;
+
+    if (output.empty()) {
+        bench.write(cout, format);
+    } else {
+        ofstream out(output.c_str());
+        bench.write(out, format);
+    }
+
+    // benchmarks whose runs keep python objects alive
+    int status = 0;
+    for (unsigned int i=0; bench.leak_check && i<bench.results.size(); i++) {
+        Result &r = bench.results[i];
+        if (r.blocks > max_blocks) {
+            cerr << "leak: " << r.name << " (size " << r.size << ") keeps " << r.blocks << " python blocks per run" << endl;
+            status = 1;
+        }
+    }
+
+    PyTools::closePython();
+    return status;
+}
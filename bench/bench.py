@@ -0,0 +1,65 @@
+# Namelist used by the benchmarks (bench/bench.cpp)
+import math
+
+scalar = 1.5
+name = "benchmark"
+
+# python functions (kept in python, vectorizable)
+def py1(x):
+    return 1./(1.+x*x)
+def py2(x, y):
+    return 1./(1.+x*x+y*y)
+def py3(x, y, z):
+    return 1./(1.+x*x+y*y+z*z)
+def py4(x, y, z, t):
+    return 1./(1.+x*x+y*y+z*z+t*t)
+for f in (py1, py2, py3, py4):
+    f.compile = False
+
+# separable python function (grids evaluated by factors)
+def separable3(x, y, z):
+    return math.exp(-x*x) * math.exp(-y*y) / (1.+z*z)
+separable3.compile = False
+
+# python functions that cannot take arrays (one call per point)
+def scalar1(x):
+    return math.exp(-x*x)
+scalar1.compile = False
+
+# vector profiles: one function returning the 3 components, or one function per component
+def fused3(x, y, z):
+    return (math.exp(-x*x), math.exp(-y*y), math.exp(-z*z))
+def vx(x, y, z):
+    return math.exp(-x*x)
+def vy(x, y, z):
+    return math.exp(-y*y)
+def vz(x, y, z):
+    return math.exp(-z*z)
+for f in (fused3, vx, vy, vz):
+    f.compile = False
+separate3 = [vx, vy, vz]
+
+# same functions, compiled in C++
+def compiled1(x):
+    return 1./(1.+x*x)
+def compiled2(x, y):
+    return 1./(1.+x*x+y*y)
+def compiled3(x, y, z):
+    return 1./(1.+x*x+y*y+z*z)
+def compiled4(x, y, z, t):
+    return 1./(1.+x*x+y*y+z*z+t*t)
+for f in (compiled1, compiled2, compiled3, compiled4):
+    f.compile = True
+
+# native profiles
+native1 = gaussian(1., center=0.5, fwhm=0.2)
+native3 = gaussian(1., center=0.5, fwhm=0.2) * gaussian(1., center=0.5, fwhm=0.3, axis="y") * gaussian(1., center=0.5, fwhm=0.4, axis="z")
+
+# components
+class Component(object):
+    def __init__(self, i):
+        self.name = "species%d" % i
+        self.mass = 1. + i
+        self.charge = -1.
+        self.number_density = compiled3
+Species = [Component(i) for i in range(8)]
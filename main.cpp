@@ -1,28 +1,224 @@
 #include "PyTools.h"
 #include "Profile.h"
+#include "ParallelEvaluator.h"
+#include "ProfilePrefetcher.h"
+#include "VectorProfile.h"
+#include "ProfileSampler.h"
+#include "ProfileIntegrator.h"
+#include "ProfileGridCache.h"
+#include "ProfileDispatcher.h"
+#include "ProfileRegistry.h"
 #include <iostream>
 #include <list>
+#include <thread>
 #include <string>
+#include <cmath>
+#include <algorithm>
 
 int main (int argc, char* argv[]) {
     
+    // a namelist snapshot is replayed without python
+    if (NamelistSnapshot::isSnapshot(argv[1])) {
+        if (!NamelistSnapshot::load(argv[1])) return 1;
+        double my_pi=0;
+        PyTools::extract("my_pi", my_pi);
+        std::cout<< "my_pi=" << my_pi << " (snapshot)" << std::endl;
+        {
+            Profile my_table_profile("my_func");
+            std::cout<< "my_func(4.5)=" << my_table_profile.valueAt(std::vector<double>{4.5}) << " (snapshot)" << std::endl;
+            std::cout<< my_table_profile.getInfo() << std::endl;
+        }
+        NamelistSnapshot::close();
+        return 0;
+    }
+    
     PyTools::openPython();
     
     std::cout << "Python version: " << PyTools::python_version() << std::endl;
 
+    // with a second argument, the values extracted and the tabulated profiles are saved in a snapshot
+    if (argc > 2) NamelistSnapshot::record();
+    
     PyTools::execFile(argv[1]);
     
     double my_pi=0;
     
     PyTools::extract("my_pi", my_pi);    
     std::cout<< "my_pi=" << my_pi << std::endl;
+    
+    // arrays of any dimension
+    PyArrayView<double> my_matrix;
+    if (PyTools::extract("my_matrix", my_matrix)) {
+        std::cout<< "my_matrix: " << my_matrix.shape(0) << "x" << my_matrix.shape(1) << ", last=" << my_matrix.data()[my_matrix.size()-1] << (my_matrix.isZeroCopy() ? " (no copy)" : " (converted)") << std::endl;
+    }
 
     Profile my_py_profile("my_func");
     for (int i=0; i<10; i++) {
-        double retval=my_py_profile.valueAt(std::vector<double>{(double)i});
+        double retval=my_py_profile.valueAt(std::array<double,1>{{(double)i}});
         std::cout<< "my_func("<<i<<")=" << retval << std::endl;
     }
     
+    // batched evaluation on a grid
+    std::vector<double> axis(10), values(10);
+    for (int i=0; i<10; i++) axis[i] = i;
+    my_py_profile.valuesAtGrid(std::vector<std::vector<double> >(1, axis), &values[0]);
+    for (int i=0; i<10; i++) {
+        std::cout<< "my_func("<<axis[i]<<")=" << values[i] << " (batched)" << std::endl;
+    }
+    
+    // tabulated evaluation
+    Profile my_table_profile("my_func");
+    double error = my_table_profile.tabulate(std::vector<double>(1, 0.), std::vector<double>(1, 9.), std::vector<unsigned int>(1, 10), 3, 1e-8);
+    std::cout<< "my_func(4.5)=" << my_table_profile.valueAt(std::vector<double>{4.5}) << " (tabulated, error " << error << ")" << std::endl;
+    
+    // native profile
+    Profile my_native_profile("my_native");
+    for (int i=0; i<10; i++) {
+        std::cout<< "my_native("<<i<<")=" << my_native_profile.valueAt(std::vector<double>{(double)i}) << std::endl;
+    }
+    
+    // compiled and python profiles
+    Profile my_gauss_profile("my_gauss"), my_python_profile("my_python_only");
+    std::cout<< "my_gauss(1,1)=" << my_gauss_profile.valueAt(std::vector<double>{1., 1.}) << std::endl;
+    std::cout<< "my_python_only(2)=" << my_python_profile.valueAt(std::vector<double>{2.}) << std::endl;
+    
+    // separable profile evaluated on a grid from its factors along each axis
+    {
+        Profile my_separable_profile("my_gauss");
+        my_separable_profile.factorize();
+        std::vector<double> fine_axis(91), grid(91*91);
+        for (int i=0; i<91; i++) fine_axis[i] = i*0.1;
+        my_separable_profile.valuesAtGrid(std::vector<std::vector<double> >(2, fine_axis), &grid[0]);
+        std::cout<< "my_gauss(1,1)=" << grid[10*91+10] << " (" << my_separable_profile.getInfo() << ")" << std::endl;
+    }
+    
+    // profiles significant on a small part of the grid are evaluated as a whole (regression: they were factorized)
+    {
+        Profile my_ridge_profile("my_ridge");
+        my_ridge_profile.factorize();
+        std::vector<double> unit_axis(1001), ridge(1001*1001), exact_ridge(1001*1001);
+        for (int i=0; i<1001; i++) unit_axis[i] = i*0.001;
+        std::vector<std::vector<double> > ridge_axes(2, unit_axis);
+        my_ridge_profile.valuesAtGrid(ridge_axes, &ridge[0]);
+        std::string info = my_ridge_profile.getInfo();
+        Profile("my_ridge").valuesAtGrid(ridge_axes, &exact_ridge[0]);
+        double ridge_error = 0.;
+        for (size_t p=0; p<ridge.size(); p++) ridge_error = std::max(ridge_error, std::abs(ridge[p]-exact_ridge[p]));
+        std::cout<< "my_ridge: error " << ridge_error << " (" << info << ")" << std::endl;
+        
+        Profile my_pulse_profile("my_pulse", "", 0, true), my_exact_pulse("my_pulse", "", 0, true);
+        my_pulse_profile.factorize();
+        std::vector<std::vector<double> > pulse_axes(1, std::vector<double>(20001));
+        for (int i=0; i<20001; i++) pulse_axes[0][i] = i*1e-4;
+        std::vector<double> pulse(20001), exact_pulse(20001);
+        for (double time : {0.2, 0.21}) {
+            my_pulse_profile.valuesAtGrid(pulse_axes, time, &pulse[0]);
+            my_exact_pulse.valuesAtGrid(pulse_axes, time, &exact_pulse[0]);
+            double pulse_error = 0.;
+            for (size_t p=0; p<pulse.size(); p++) pulse_error = std::max(pulse_error, std::abs(pulse[p]-exact_pulse[p]));
+            std::cout<< "my_pulse(t=" << time << "): error " << pulse_error << " (" << my_pulse_profile.getInfo() << ")" << std::endl;
+        }
+    }
+    
+    // grid kept on disk: the next runs map it instead of evaluating my_gauss again
+    {
+        std::vector<double> fine_axis(91);
+        for (int i=0; i<91; i++) fine_axis[i] = i*0.1;
+        ProfileGridCache cached_grid(my_gauss_profile, std::vector<std::vector<double> >(2, fine_axis));
+        std::cout<< "my_gauss(1,1)=" << cached_grid.values()[10*91+10] << " (grid cache)" << std::endl;
+    }
+
+    // smooth python profile replaced by a few Chebyshev coefficients
+    {
+        Profile my_smooth_profile("my_python_only");
+        double error = my_smooth_profile.chebyshev(std::vector<double>{0.}, std::vector<double>{4.});
+        std::cout<< "my_python_only(2)=" << my_smooth_profile.valueAt(std::vector<double>{2.}) << " ("
+                 << my_smooth_profile.getInfo() << ", error " << (error < 1e-10 ? "below 1e-10" : std::to_string(error)) << ")" << std::endl;
+    }
+    
+    // profile with 3 components returned by one function, all filled in one pass
+    {
+        VectorProfile my_velocity_profile("my_velocity", 3);
+        std::vector<double> velocity(3*10);
+        my_velocity_profile.valuesAt(std::vector<double*>(1, &axis[0]), 10, &velocity[0]);
+        std::cout<< "my_velocity(3)=(" << velocity[9] << ", " << velocity[10] << ", " << velocity[11] << ") ("
+                 << my_velocity_profile.getInfo() << ")" << std::endl;
+    }
+    
+    // positions of particles distributed like my_gauss (same positions for the same seed)
+    {
+        ProfileSampler sampler(my_gauss_profile, std::vector<double>{0., -2.}, std::vector<double>{4., 2.}, std::vector<unsigned int>{40, 40});
+        std::vector<double> x(10000), y(10000);
+        sampler.sample(10000, std::vector<double*>{&x[0], &y[0]}, 1);
+        double mean = 0.;
+        for (double xp : x) mean += xp / x.size();
+        std::cout<< "my_gauss particles: <x>=" << mean << ", integral " << sampler.getTotalWeight() << std::endl;
+    }
+    
+    // integral and moments of my_gauss (exact: 4 pi^2, centroid 2, rms width sqrt(2))
+    {
+        ProfileIntegrator integrator(1e-10);
+        ProfileMoments moments = integrator.moments(my_gauss_profile, std::vector<double>{-18., -20.}, std::vector<double>{22., 20.});
+        std::cout<< "my_gauss integral=" << moments.integral << ", centroid " << moments.centroid(0)
+                 << ", rms " << moments.rms(0) << " (" << integrator.getInfo() << ")" << std::endl;
+    }
+    
+    // C++ array given to a namelist function as a numpy array (no copy: python keeps the array alive while it holds views)
+    {
+        std::shared_ptr<std::vector<double> > field = std::make_shared<std::vector<double> >(20*30, 1.);
+        PyArrayExport exported(field->data(), std::vector<size_t>{20, 30}, true, std::vector<size_t>(), field);
+        PyTools::PyRef field_view = exported.view();
+        double sum = PyTools::runPyFunction<double>("my_diagnostic", std::vector<PyObject*>(1, field_view));
+        std::cout<< "my_diagnostic=" << sum << ", field(0,0)=" << (*field)[0] << std::endl;
+    }
+    
+    // parallel evaluation
+    {
+        ParallelEvaluator evaluator;
+        std::vector<double> big_axis(1000), big_values(1000);
+        for (int i=0; i<1000; i++) big_axis[i] = i*0.01;
+        evaluator.valuesAtGrid(my_python_profile, std::vector<std::vector<double> >(1, big_axis), &big_values[0], layout_rowMajor, 100);
+        std::cout<< "my_python_only(9.99)=" << big_values[999] << " (" << evaluator.getInfo() << ")" << std::endl;
+    }
+    
+    // single points requested by several threads, evaluated together by one dispatcher
+    {
+        ProfileDispatcher dispatcher(my_python_profile);
+        std::vector<double> sums(4, 0.);
+        std::vector<std::thread> threads;
+        for (int t=0; t<4; t++) {
+            threads.push_back(std::thread([&dispatcher, &sums, t]() {
+                std::vector<std::future<double> > results;
+                for (int i=0; i<100; i++) {
+                    double x = (t*100+i)*0.01;
+                    results.push_back(dispatcher.submit(&x));
+                }
+                for (int i=0; i<100; i++) sums[t] += results[i].get();
+            }));
+        }
+        for (int t=0; t<4; t++) threads[t].join();
+        std::cout<< "sum of my_python_only(0:4:0.01)=" << sums[0]+sums[1]+sums[2]+sums[3] << " (4 threads)" << std::endl;
+    }
+    
+    // space-time profile, the next time step being computed in the background
+    Profile my_envelope_profile("my_envelope", "", 0, true);
+    {
+        ProfilePrefetcher prefetcher(my_envelope_profile, std::vector<std::vector<double> >(1, axis), 0., 1.);
+        for (int step=0; step<4; step++) {
+            double time;
+            const double * envelope = prefetcher.next(&time);
+            std::cout<< "my_envelope(2, " << time << ")=" << envelope[2] << std::endl;
+        }
+    }
+    
+    for (Profile* p : {&my_py_profile, &my_table_profile, &my_native_profile, &my_gauss_profile, &my_python_profile, &my_envelope_profile}) {
+        std::cout<< p->getInfo() << std::endl;
+    }
+    // profiles of the same python function share its evaluation
+    std::cout<< "profile functions: " << ProfileRegistry::getInfo() << std::endl;
+    
+    if (argc > 2) NamelistSnapshot::save(argv[2]);
+    
     PyTools::closePython();
     return 0;
 }
@@ -0,0 +1,261 @@
+# -------------------
+# Profiles evaluated natively in C++ (see FunctionNative.h)
+# They remain regular python callables, so they can be used anywhere in the namelist.
+# Example:  n = gaussian(1., center=10., fwhm=4.) * trapezoidal(1., vacuum=2., plateau=20., axis="y")
+# -------------------
+import math
+
+class NativeProfile(object):
+    """Profile recognized by the C++ Profile class (tag `_native`)"""
+    def __init__(self, native, params=[], axis=0, dim=1, children=[]):
+        if axis in ["x", "y", "z"]: axis = "xyz".index(axis)
+        self._native  = native
+        self.params   = [float(p) for p in params]
+        self.axis     = int(axis)
+        self.children = list(children)
+        self.dim      = max([int(dim), self.axis+1] + [c.dim for c in self.children])
+    def __call__(self, *x):
+        return self._value(x)
+    def _value(self, x):
+        p = self.params
+        if self._native == "constant":
+            return p[0]
+        if self._native == "sum":
+            return sum(c._value(x) for c in self.children)
+        if self._native == "product":
+            v = 1.
+            for c in self.children: v *= c._value(x)
+            return v
+        if self._native == "shift":
+            return self.children[0]._value([x[i]-(p[i] if i<len(p) else 0.) for i in range(len(x))])
+        if self._native == "scale":
+            return p[0] * self.children[0]._value(x)
+        x = x[self.axis]
+        if self._native == "gaussian":
+            return p[0] * math.exp( -math.log(2.) * (2.*(x-p[1])/p[2])**(2*int(p[3])) )
+        if self._native == "trapezoidal":
+            max, vacuum, plateau, slope1, slope2 = p
+            x -= vacuum
+            if x < 0.: return 0.
+            if x < slope1: return max * x / slope1
+            x -= slope1
+            if x <= plateau: return max
+            x -= plateau
+            if x < slope2: return max * (1. - x / slope2)
+            return 0.
+        if self._native == "polynomial":
+            v = 0.
+            for c in reversed(p[1:]): v = v*(x-p[0]) + c
+            return v
+        if self._native == "cosine":
+            base, amplitude, vacuum, length, phi, number = p
+            if x < vacuum or x > vacuum+length: return 0.
+            return base + amplitude * math.cos(phi + 2.*math.pi*number*(x-vacuum)/length)
+        raise Exception("Unknown native profile "+self._native)
+    def __add__(self, other):
+        if not isinstance(other, NativeProfile): other = constant(other)
+        return sum_profiles(self, other)
+    __radd__ = __add__
+    def __mul__(self, other):
+        if isinstance(other, NativeProfile): return product_profiles(self, other)
+        return scale(self, other)
+    __rmul__ = __mul__
+    def shift(self, *offsets):
+        return NativeProfile("shift", offsets, children=[self])
+
+def constant(value, dim=1):
+    return NativeProfile("constant", [value], dim=dim)
+
+def gaussian(max, center=0., fwhm=1., order=1, axis=0, dim=1):
+    return NativeProfile("gaussian", [max, center, fwhm, order], axis, dim)
+
+def trapezoidal(max, vacuum=0., plateau=float("inf"), slope1=0., slope2=0., axis=0, dim=1):
+    return NativeProfile("trapezoidal", [max, vacuum, plateau, slope1, slope2], axis, dim)
+
+def polynomial(coefficients, center=0., axis=0, dim=1):
+    """ sum of coefficients[i] * (x-center)**i """
+    return NativeProfile("polynomial", [center]+list(coefficients), axis, dim)
+
+def cosine(base, amplitude=1., vacuum=0., length=float("inf"), phi=0., number=1., axis=0, dim=1):
+    """ base + amplitude*cos(phi + 2 pi number (x-vacuum)/length) between vacuum and vacuum+length
+        (a cosine ramp from 0 to m is cosine(m/2., -m/2., vacuum, length, number=0.5)) """
+    return NativeProfile("cosine", [base, amplitude, vacuum, length, phi, number], axis, dim)
+
+def sum_profiles(*profiles):
+    return NativeProfile("sum", children=profiles)
+
+def product_profiles(*profiles):
+    return NativeProfile("product", children=profiles)
+
+def shift(profile, *offsets):
+    return profile.shift(*offsets)
+
+def scale(profile, factor):
+    return NativeProfile("scale", [factor], children=[profile])
+
+
+# -------------------
+# Translation of simple python profiles into a program for the C++ expression evaluator
+# (see FunctionExpression.h). Returns None when the function uses anything unsupported,
+# in which case the profile is evaluated by python.
+# -------------------
+def _compile_profile(f):
+    import ast, inspect, textwrap, numbers
+    try:
+        tree = ast.parse(textwrap.dedent(inspect.getsource(f)))
+    except Exception:
+        return None
+    # Find the definition: a function, or a lambda alone on its line
+    defs = [n for n in ast.walk(tree) if isinstance(n, (ast.FunctionDef, ast.Lambda))]
+    if len(defs) != 1: return None
+    node = defs[0]
+    args = [a.arg if hasattr(a, "arg") else a.id for a in node.args.args]
+    if node.args.vararg or node.args.kwarg or len(args) != f.__code__.co_argcount: return None
+    if isinstance(node, ast.Lambda):
+        body = [ast.Return(node.body)]
+    else:
+        body = [s for s in node.body if not (isinstance(s, ast.Expr) and type(s.value).__name__ in ["Str", "Constant"])]
+    # Names visible from the function: closure, then globals, then builtins
+    names = {}
+    names.update(__builtins__ if isinstance(__builtins__, dict) else vars(__builtins__))
+    names.update(f.__globals__)
+    if f.__closure__:
+        for name, cell in zip(f.__code__.co_freevars, f.__closure__):
+            names[name] = cell.cell_contents
+    # Functions that have an equivalent in C++
+    import math
+    functions = {}
+    modules = [math]
+    try:
+        import numpy
+        modules.append(numpy)
+    except ImportError:
+        pass
+    for m in modules:
+        for name in ["exp", "log", "log10", "sqrt", "sin", "cos", "tan", "sinh", "cosh", "tanh",
+                     "arcsin", "arccos", "arctan", "asin", "acos", "atan", "floor", "ceil", "fabs", "abs"]:
+            if hasattr(m, name):
+                functions[id(getattr(m, name))] = name.replace("arc", "a").replace("fabs", "abs")
+        for name in ["pow", "power", "atan2", "arctan2"]:
+            if hasattr(m, name):
+                functions[id(getattr(m, name))] = "pow" if "pow" in name else "atan2"
+    functions[id(abs)] = "abs"
+    functions[id(pow)] = "pow"
+    binops = {"Add":"add", "Sub":"sub", "Mult":"mul", "Div":"div", "Pow":"pow", "FloorDiv":"floordiv", "Mod":"mod"}
+    cmpops = {"Lt":"lt", "LtE":"le", "Gt":"gt", "GtE":"ge", "Eq":"eq", "NotEq":"ne"}
+    class Unsupported(Exception): pass
+    def value(obj):
+        # python object -> number (bool and int included)
+        if isinstance(obj, numbers.Real): return float(obj)
+        raise Unsupported()
+    def resolve(n):
+        # python object denoted by a name or attribute, which is not a variable
+        if isinstance(n, ast.Name):
+            if n.id not in names: raise Unsupported()
+            return names[n.id]
+        if isinstance(n, ast.Attribute):
+            o = resolve(n.value)
+            if not hasattr(o, n.attr): raise Unsupported()
+            return getattr(o, n.attr)
+        raise Unsupported()
+    locals_ = {}
+    def expr(n, program):
+        t = type(n).__name__
+        if t in ["Num", "Constant"]:
+            program.append(("const", value(n.n if t=="Num" else n.value)))
+        elif t == "Name" and n.id in locals_:
+            program.extend(locals_[n.id])
+        elif t == "Name" and n.id in args:
+            program.append(("var", args.index(n.id)))
+        elif t in ["Name", "Attribute"]:
+            program.append(("const", value(resolve(n))))
+        elif t == "BinOp" and type(n.op).__name__ in binops:
+            expr(n.left, program); expr(n.right, program)
+            program.append((binops[type(n.op).__name__], 0))
+        elif t == "UnaryOp" and type(n.op).__name__ in ["USub", "UAdd"]:
+            expr(n.operand, program)
+            if type(n.op).__name__ == "USub": program.append(("neg", 0))
+        elif t == "Call" and not n.keywords and not getattr(n, "starargs", None):
+            op = functions.get(id(resolve(n.func)))
+            if op is None or len(n.args) != (2 if op in ["pow", "atan2"] else 1): raise Unsupported()
+            for a in n.args: expr(a, program)
+            program.append((op, 0))
+        elif t == "Compare" and len(n.ops) == 1 and type(n.ops[0]).__name__ in cmpops:
+            expr(n.left, program); expr(n.comparators[0], program)
+            program.append((cmpops[type(n.ops[0]).__name__], 0))
+        elif t == "BoolOp":
+            expr(n.values[0], program)
+            for v in n.values[1:]:
+                expr(v, program)
+                program.append(("and" if type(n.op).__name__ == "And" else "or", 0))
+        elif t == "IfExp":
+            expr(n.test, program); expr(n.body, program); expr(n.orelse, program)
+            program.append(("select", 0))
+        else:
+            raise Unsupported()
+        return program
+    try:
+        for i, s in enumerate(body):
+            last = (i == len(body)-1)
+            if last and isinstance(s, ast.Return) and s.value is not None:
+                return [(op, float(v)) for op, v in expr(s.value, [])]
+            if not last and isinstance(s, ast.Assign) and len(s.targets) == 1 and isinstance(s.targets[0], ast.Name):
+                locals_[s.targets[0].id] = expr(s.value, [])
+            else:
+                raise Unsupported()
+    except Unsupported:
+        pass
+    return None
+
+
+# -------------------
+# Fingerprint of a profile for the grid cache (see ProfileGridCache.h): hash of its bytecode,
+# constants, default arguments, closure and of the globals it uses (functions recursively),
+# or of the parameters of a native profile. Returns None when it cannot be fingerprinted.
+# -------------------
+def _fingerprint(f):
+    import hashlib, types
+    visiting = set()
+    def describe(v, depth):
+        if depth > 8:
+            raise ValueError()
+        if isinstance(v, NativeProfile):
+            return repr([v._native, v.dim, v.axis, v.params] + [describe(c, depth+1) for c in v.children])
+        if isinstance(v, types.ModuleType):
+            return "module " + v.__name__
+        if isinstance(v, types.FunctionType):
+            # a recursive function is described by its name the second time
+            if id(v) in visiting:
+                return "recursive " + v.__qualname__
+            visiting.add(id(v))
+            code, names = v.__code__, set()
+            codes = [code]
+            while codes:
+                c = codes.pop()
+                names.update(c.co_names)
+                codes += [k for k in c.co_consts if isinstance(k, types.CodeType)]
+            parts = [describe(code, depth+1), describe(v.__defaults__, depth+1), describe(v.__kwdefaults__, depth+1)]
+            parts += [describe(cell.cell_contents, depth+1) for cell in (v.__closure__ or [])]
+            parts += [n + "=" + describe(v.__globals__[n], depth+1) for n in sorted(names) if n in v.__globals__]
+            visiting.discard(id(v))
+            return "function(" + ",".join(parts) + ")"
+        if isinstance(v, types.CodeType):
+            # not marshal.dumps, whose output depends on the reference counts
+            return "code(%s,%r,%r,%r,%r,%r,%r,%r,%s)" % (v.co_code.hex(), v.co_argcount, v.co_kwonlyargcount, v.co_flags,
+                v.co_names, v.co_varnames, v.co_freevars, v.co_cellvars, describe(v.co_consts, depth+1))
+        if isinstance(v, (types.BuiltinFunctionType, type)):
+            return "builtin " + str(getattr(v, "__module__", "")) + "." + v.__qualname__
+        if isinstance(v, (list, tuple)):
+            return type(v).__name__ + "(" + ",".join(describe(x, depth+1) for x in v) + ")"
+        if isinstance(v, dict):
+            return "dict(" + ",".join(repr(k) + ":" + describe(v[k], depth+1) for k in sorted(v, key=repr)) + ")"
+        if hasattr(v, "tobytes") and hasattr(v, "shape"):
+            return "array(%s,%s,%s)" % (v.dtype, v.shape, hashlib.sha256(v.tobytes()).hexdigest())
+        if v is None or isinstance(v, (bool, int, float, complex, str, bytes)):
+            return repr(v)
+        # other objects (whose repr may not describe the value)
+        raise ValueError()
+    try:
+        return hashlib.sha256(describe(f, 0).encode()).hexdigest()
+    except Exception:
+        return None
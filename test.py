@@ -2,7 +2,38 @@ import math
 
 my_pi=math.pi
 
+my_matrix = [[1., 2., 3.], [4., 5., 6.]]
+
 def my_func(x):
    return x*x
 
-print("Here I am in python")
\ No newline at end of file
+print("Here I am in python")
+my_native = gaussian(1., center=4., fwhm=2.) * trapezoidal(2., vacuum=1., plateau=6., slope1=2., slope2=1.) + 0.5
+
+def my_gauss(x, y):
+    return my_pi * math.exp(-((x-2.)**2 + y**2) / 4.)
+my_gauss.compile = True
+
+def my_python_only(x):
+    return sum([x**i for i in range(3)])
+
+def my_envelope(x, t):
+    return math.exp(-(x-t)**2) * (1. if t>0 else 0.)
+my_envelope.compile = False
+
+def my_velocity(x):
+    return (0.1*x, 0.2*x, 0.)
+
+def my_diagnostic(field):
+    # numpy view of a C++ array: halved in place, and reduced at numpy speed
+    field *= 0.5
+    return field[:, ::2].sum()
+
+# localized profiles that the separability probe must not factorize
+def my_ridge(x, y):
+    return math.exp(-1e5*(x-y)**2)
+my_ridge.compile = True
+
+def my_pulse(x, t):
+    return math.exp(-((x-t)/0.005)**2)
+my_pulse.compile = False